@@ -0,0 +1,420 @@
+#include <functional>
+
+#include <QDir>
+#include <QFile>
+#include <QImage>
+#include <QPainter>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QTextStream>
+#include <QStringList>
+#include <QJsonDocument>
+#include <QElapsedTimer>
+#include <QTemporaryDir>
+#include <QTemporaryFile>
+#include <QGuiApplication>
+
+#include "ui.h"
+#include "router.h"
+#include "expander.h"
+#include "generator.h"
+#include "utility.h"
+#include "washplanner.h"
+
+// Benchmarks of the hot paths of the simulator, on the command files of a directory, on routed random assays and on
+// long generated protocols:
+//   dmfb-bench [input directory] [output file]
+// Every case runs until it has taken minimumTime, and the results are written as JSON, to standard output by default.
+
+const qint64 minimumTime = 200; // in milliseconds, per case
+const qint32 imageSize = 800;
+const qint32 samples = 50; // moments per pass of the status and rendering cases
+const quint64 benchSeed = 20190819;
+const qint32 syntheticSizes[] = {10, 20, 40}; // droplets of the random assays
+const qint64 generatedLengths[] = {10000, 100000}; // commands of the generated protocols
+
+struct BenchInput {
+	QString name, url;
+	ChipConfig config;
+	bool wash; // whether to time wash planning, which takes too long on the generated protocols
+};
+
+QJsonArray results;
+
+// Repeat body until it has taken minimumTime; body returns the number of operations it did
+void measure(const QString &name, const QString &input, const std::function<qint64()> &body) {
+	QElapsedTimer timer;
+	timer.start();
+	qint64 operations = 0, runs = 0;
+	do {
+		operations += body();
+		++runs;
+	} while (timer.elapsed() < minimumTime);
+	qint64 elapsed = timer.nsecsElapsed();
+
+	QJsonObject result;
+	result["name"] = name;
+	result["input"] = input;
+	result["runs"] = double(runs);
+	result["operations"] = double(operations);
+	result["nsPerOperation"] = operations > 0 ? double(elapsed) / operations : 0.0;
+	result["operationsPerSecond"] = elapsed > 0 ? operations * 1e9 / elapsed : 0.0;
+	results.append(result);
+}
+
+void setPort(ChipConfig &config, qint32 x, qint32 y, PortType T) {
+	if (x == 0 && y + 1 < config.rows) {
+		config.L[y] = T;
+	} else if (y + 1 == config.rows && x + 1 < config.columns) {
+		config.B[x] = T;
+	} else if (x + 1 == config.columns && y > 0) {
+		config.R[y] = T;
+	} else if (y == 0 && x > 0) {
+		config.T[x] = T;
+	}
+}
+
+// The first border cell without a port, or false if there is none
+bool freeBorderCell(const ChipConfig &config, qint32 &x, qint32 &y) {
+	for (x = 0; x < config.columns; ++x) {
+		for (y = 0; y < config.rows; ++y) {
+			if (x > 0 && x + 1 < config.columns && y > 0 && y + 1 < config.rows) continue;
+			if (isPortType(x, y, config, PortType::none)) return true;
+		}
+	}
+	return false;
+}
+
+// The smallest chip holding every cell of a command file, with ports where droplets are input and output,
+// and a wash and a waste port on free border cells
+bool chipOf(const QString &url, ChipConfig &config) {
+	QFile file(url);
+	if (!file.open(QFile::ReadOnly | QFile::Text)) return false;
+	QTextStream fs(&file);
+
+	QVector<QStringList> lines;
+	qint32 columns = 3, rows = 3;
+	while (!fs.atEnd()) {
+		QStringList tokens = fs.readLine().replace(',', ' ').replace(';', ' ').simplified().toLower().split(' ', QString::SkipEmptyParts);
+		if (tokens.size() < 4) continue;
+		for (qint32 i = 2; i + 1 < tokens.size(); i += 2) {
+			columns = std::max(columns, tokens[i].toInt());
+			rows = std::max(rows, tokens[i + 1].toInt());
+		}
+		lines.push_back(tokens);
+	}
+	if (rows == 3 && columns == 3) {
+		++columns;
+	}
+	config.init(rows, columns);
+	if (!config.valid) return false;
+
+	for (const QStringList &tokens : lines) {
+		if (tokens[0] == "input" || tokens[0] == "output") {
+			setPort(config, tokens[2].toInt() - 1, rows - tokens[3].toInt(), tokens[0] == "input" ? PortType::input : PortType::output);
+		}
+	}
+	qint32 x, y;
+	config.hasWash = false;
+	if (freeBorderCell(config, x, y)) {
+		setPort(config, x, y, PortType::wash);
+		if (freeBorderCell(config, x, y)) {
+			setPort(config, x, y, PortType::waste);
+			config.hasWash = true;
+		}
+	}
+	return true;
+}
+
+// Route a random assay of the given number of droplets on a 12 x 12 chip into the command file url
+bool synthesize(qint32 count, const QString &url, ChipConfig &config) {
+	config.init(12, 12);
+	config.L[2] = config.L[8] = config.T[4] = PortType::input;
+	config.R[3] = config.R[9] = config.B[6] = PortType::output;
+	config.L[5] = PortType::wash;
+	config.R[6] = PortType::waste;
+	config.hasWash = true;
+
+	Random random(benchSeed, quint64(count));
+	QStringList live, text;
+	qint32 names = 0, inputs = 0;
+	auto fresh = [&]() -> QString { return QString("d%1").arg(names++); };
+	while (inputs < count || !live.empty()) {
+		qint32 r = random.randInt(0, 9);
+		if ((live.size() < 2 || (r < 3 && live.size() < 5)) && inputs < count) {
+			live.push_back(fresh());
+			text.push_back(QString("Input %1;").arg(live.back()));
+			++inputs;
+			continue;
+		}
+		QString a = live.takeAt(random.randInt(0, live.size() - 1));
+		if (r < 5 && !live.empty()) {
+			QString b = live.takeAt(random.randInt(0, live.size() - 1)), c = fresh();
+			text.push_back(QString("Merge %1, %2, %3;").arg(c, a, b));
+			live.push_back(c);
+		} else if (r < 7) {
+			QString b = fresh();
+			text.push_back(QString("Mix %1, %2, %3;").arg(b, a).arg(random.randInt(1, 8)));
+			live.push_back(b);
+		} else if (r < 8 && inputs < count && live.size() < 4) {
+			QString b = fresh(), c = fresh();
+			text.push_back(QString("Split %1, %2, %3;").arg(b, c, a));
+			live.push_back(b);
+			live.push_back(c);
+		} else {
+			text.push_back(QString("Output %1;").arg(a));
+		}
+	}
+
+	QString assayUrl = url + ".assay";
+	QFile assayFile(assayUrl);
+	if (!assayFile.open(QFile::WriteOnly | QFile::Text)) return false;
+	QTextStream(&assayFile) << text.join('\n') << '\n';
+	assayFile.close();
+
+	QVector<AssayOperation> assay;
+	QStringList commands;
+	QString message;
+	AssayRouter router;
+	if (!loadAssay(assayUrl, config, assay, message) || !router.route(config, assay, commands, message)) return false;
+
+	QFile file(url);
+	if (!file.open(QFile::WriteOnly | QFile::Text)) return false;
+	QTextStream(&file) << commands.join('\n') << '\n';
+	return true;
+}
+
+void benchInput(const BenchInput &in) {
+	QVector<Droplet> droplets;
+	qint64 minTime, maxTime;
+	Timeline timeline;
+	ErrorLog error(-2, "");
+
+	// Parsing and validation, per command
+	qint32 commands = 0;
+	QByteArray text;
+	QFile file(in.url);
+	if (file.open(QFile::ReadOnly)) {
+		text = file.readAll();
+		for (const QByteArray &line : text.split('\n')) {
+			if (!line.trimmed().isEmpty()) ++commands;
+		}
+	}
+	measure("loadFile", in.name, [&]() -> qint64 {
+		::loadFile(in.url, in.config, droplets, minTime, maxTime, timeline, error, benchSeed);
+		return commands;
+	});
+
+	// Reloading after the last line is taken away or put back, per reload, with the rewrite of the file
+	QTemporaryFile copy;
+	qint32 last = text.lastIndexOf('\n', text.size() - 2) + 1;
+	if (last > 0 && copy.open()) {
+		const QByteArray versions[2] = {text, text.left(last)};
+		qint32 version = 0;
+		copy.write(text);
+		copy.flush();
+		ProtocolLoader loader;
+		loader.load(copy.fileName(), in.config, benchSeed, false);
+		measure("ProtocolLoader::reload", in.name, [&]() -> qint64 {
+			version ^= 1;
+			copy.resize(0);
+			copy.seek(0);
+			copy.write(versions[version]);
+			copy.flush();
+			loader.reload();
+			return 1;
+		});
+	}
+	// Live input, per command; lines that come too late are refused, as they would be
+	QVector<CommandRecord> records;
+	CommandExpander expander(in.url);
+	QString message;
+	qint32 line = 0;
+	for (const QByteArray &s : text.split('\n')) {
+		expander.feed(QString::fromUtf8(s), line++, [&records](const CommandRecord &record, QString &) -> bool {
+			records.push_back(record);
+			return true;
+		}, message);
+	}
+	if (!records.empty()) {
+		ProtocolLoader loader;
+		measure("ProtocolLoader::append", in.name, [&]() -> qint64 {
+			loader.startLive(in.config, benchSeed, true);
+			for (const CommandRecord &record : records) {
+				loader.append(record, message);
+			}
+			loader.endLive();
+			return records.size();
+		});
+	}
+	maxTime = (maxTime / 1000) * 1000;
+
+	// Droplet status, per droplet and moment
+	measure("getRealTimeStatus", in.name, [&]() -> qint64 {
+		DropletStatus s;
+		qreal x, y;
+		for (qint32 k = 0; k < samples; ++k) {
+			qreal t = (minTime + (maxTime - minTime) * k / samples) / 1000.0;
+			for (qint32 i = 0; i < droplets.size(); ++i) {
+				getRealTimeStatus(droplets[i], t, s, x, y);
+			}
+		}
+		return qint64(samples) * droplets.size();
+	});
+	measure("interpolation", in.name, [&]() -> qint64 {
+		qint64 count = 0;
+		qreal x, y;
+		for (qint32 i = 0; i < droplets.size(); ++i) {
+			for (qint32 k = 1; k < droplets[i].size(); ++k, ++count) {
+				interpolation(droplets[i][k - 1], droplets[i][k], (droplets[i][k - 1].t + droplets[i][k].t) / 2.0, x, y);
+			}
+		}
+		return count;
+	});
+
+	// Rendering, per frame
+	ContaminationMap contamination;
+	ContaminationSummary summary;
+	fastForward(in.config, timeline, maxTime, contamination, summary);
+	CellMask obstacles(in.config.rows, in.config.columns);
+	QImage image(imageSize, imageSize, QImage::Format_ARGB32_Premultiplied);
+	auto frames = [&](const std::function<void(qreal, QPainter *)> &render) -> std::function<qint64()> {
+		return [&, render]() -> qint64 {
+			for (qint32 k = 0; k < samples; ++k) {
+				QPainter painter(&image);
+				painter.setRenderHints(QPainter::Antialiasing);
+				render((minTime + (maxTime - minTime) * k / samples) / 1000.0, &painter);
+			}
+			return samples;
+		};
+	};
+	const ChipConfig &config = in.config;
+	qreal W = imageSize, H = imageSize;
+	measure("renderGrid", in.name, frames([&](qreal, QPainter *g) { renderGrid(config, W, H, g); }));
+	measure("renderPortConfigGrid", in.name, frames([&](qreal, QPainter *g) { renderPortConfigGrid(config, W, H, g); }));
+	measure("renderPortConfigMask", in.name, frames([&](qreal, QPainter *g) { renderPortConfigMask(config, W, H, g); }));
+	measure("renderPortType", in.name, frames([&](qreal, QPainter *g) { renderPortType(config, W, H, g); }));
+	measure("renderDroplets", in.name, frames([&](qreal t, QPainter *g) { renderDroplets(config, droplets, t, W, H, g); }));
+	measure("renderTime", in.name, frames([&](qreal t, QPainter *g) { renderTime(config, t, maxTime / 1000.0, W, H, g); }));
+	measure("renderGridAxisNumber", in.name, frames([&](qreal, QPainter *g) { renderGridAxisNumber(config, W, H, g); }));
+	measure("renderContaminants", in.name, frames([&](qreal, QPainter *g) { renderContaminants(config, W, H, benchSeed, droplets, contamination, g); }));
+	measure("renderContaminantCount", in.name, frames([&](qreal, QPainter *g) { renderContaminantCount(config, W, H, contamination, g); }));
+	measure("renderContaminantSummary", in.name, frames([&](qreal, QPainter *g) { renderContaminantSummary(config, W, H, summary, g); }));
+	measure("renderWashObstacles", in.name, frames([&](qreal, QPainter *g) { renderWashObstacles(config, W, H, obstacles, g); }));
+
+	// Wash planning, per plan; a new planner every time so that nothing is cached
+	if (!in.wash || !config.hasWash) return;
+	QVector<Position> targets;
+	for (qint32 x = 0; x < config.columns; ++x) {
+		for (qint32 y = 0; y < config.rows; ++y) {
+			if (!contamination[x][y].empty()) {
+				targets.push_back(Position(x, y));
+			}
+		}
+	}
+	QVector<Position> steps;
+	if (WashPlanner().plan(config, obstacles, targets, steps) == WashPlanner::Planned) {
+		measure("renderWash", in.name, frames([&](qreal t, QPainter *g) { renderWash(config, W, H, (t - minTime / 1000.0) * (steps.size() - 1) / std::max((maxTime - minTime) / 1000.0, 1.0), steps, halfSaturatedCyan, g); }));
+		measure("WashPlanner::plan", in.name, [&]() -> qint64 {
+			WashPlanner().plan(config, obstacles, targets, steps);
+			return 1;
+		});
+		measure("WashPlanner::planFleet", in.name, [&]() -> qint64 {
+			QVector<QVector<Position>> routes;
+			WashPlanner().planFleet(config, obstacles, targets, 4, routes);
+			return 1;
+		});
+	}
+
+	ContaminationMap clean(config.columns, QVector<QSet<qint32>>(config.rows));
+	QVector<WashDemand> demands = washDemands(config, droplets, timeline, clean, minTime / 1000.0);
+	if (!demands.empty()) {
+		measure("OccupancyIndex::build", in.name, [&]() -> qint64 {
+			OccupancyIndex occupancy;
+			occupancy.build(config, droplets);
+			return 1;
+		});
+		OccupancyIndex occupancy;
+		occupancy.build(config, droplets);
+		measure("WashPlanner::planOnline", in.name, [&]() -> qint64 {
+			QVector<WashTrip> trips;
+			qint32 missed;
+			WashPlanner().planOnline(config, obstacles, occupancy, demands, std::max(qint32(minTime / 1000), 0), trips, missed);
+			return 1;
+		});
+	}
+}
+
+int main(int argc, char *argv[]) {
+	// Rendering into images needs no display
+	if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM")) {
+		qputenv("QT_QPA_PLATFORM", "offscreen");
+	}
+	QGuiApplication a(argc, argv);
+
+	QDir inputDir(argc > 1 ? argv[1] : "input");
+	QVector<BenchInput> inputs;
+	for (const QFileInfo &info : inputDir.entryInfoList(QStringList("*.txt"), QDir::Files, QDir::Name)) {
+		BenchInput in;
+		in.name = info.completeBaseName();
+		in.url = info.absoluteFilePath();
+		in.wash = true;
+		if (chipOf(in.url, in.config)) {
+			inputs.push_back(in);
+		}
+	}
+
+	QTemporaryDir temp;
+	for (qint32 count : syntheticSizes) {
+		BenchInput in;
+		in.name = QString("synthetic-%1").arg(count);
+		in.url = temp.filePath(in.name + ".txt");
+		in.wash = true;
+		if (synthesize(count, in.url, in.config)) {
+			inputs.push_back(in);
+		}
+	}
+	for (qint64 length : generatedLengths) {
+		GeneratorSettings settings;
+		settings.rows = 20;
+		settings.droplets = 10;
+		settings.commands = length;
+		settings.seed = benchSeed;
+		ProtocolGenerator generator(settings);
+
+		BenchInput in;
+		in.name = QString("generated-%1").arg(length);
+		in.url = temp.filePath(in.name + ".txt");
+		in.config = generator.chip();
+		in.wash = false;
+		QFile file(in.url);
+		QString message;
+		if (file.open(QFile::WriteOnly | QFile::Text)) {
+			QTextStream out(&file);
+			if (generator.generate(out, message)) {
+				inputs.push_back(in);
+			}
+		}
+	}
+
+	for (const BenchInput &in : inputs) {
+		benchInput(in);
+	}
+
+	QJsonObject report;
+	report["qt"] = QString(qVersion());
+	report["minimumTime"] = double(minimumTime);
+	report["imageSize"] = imageSize;
+	report["results"] = results;
+	QByteArray json = QJsonDocument(report).toJson();
+
+	if (argc > 2) {
+		QFile out(argv[2]);
+		if (!out.open(QFile::WriteOnly)) return 1;
+		out.write(json);
+	} else {
+		QTextStream(stdout) << json;
+	}
+	return 0;
+}
@@ -0,0 +1,36 @@
+#-------------------------------------------------
+#
+# Benchmarks of the simulator hot paths, built from the sources of dmfb
+#
+#-------------------------------------------------
+
+QT       += core gui widgets
+
+TARGET = dmfb-bench
+TEMPLATE = app
+
+CONFIG += c++11 console
+CONFIG -= app_bundle
+
+DEFINES += QT_DEPRECATED_WARNINGS
+
+INCLUDEPATH += ..
+
+SOURCES += \
+        bench.cpp \
+        ../expander.cpp \
+        ../generator.cpp \
+        ../profiler.cpp \
+        ../router.cpp \
+        ../ui.cpp \
+        ../utility.cpp \
+        ../washplanner.cpp
+
+HEADERS += \
+        ../expander.h \
+        ../generator.h \
+        ../profiler.h \
+        ../router.h \
+        ../ui.h \
+        ../utility.h \
+        ../washplanner.h
@@ -0,0 +1,392 @@
+#include "compactor.h"
+
+#include <limits>
+#include <algorithm>
+
+#include <QFile>
+#include <QHash>
+#include <QPair>
+#include <QTextStream>
+
+static const qint32 never = std::numeric_limits<qint32>::max();
+
+CommandCompactor::CommandCompactor() : rows(0), columns(0), horizon(0), origin(0), shifted(0) {}
+
+bool CommandCompactor::compact(const QString &url, const ChipConfig &config, QStringList &commands, QString &message) {
+	rows = config.rows;
+	columns = config.columns;
+	shifted = 0;
+	commands.clear();
+
+	if (!parse(url, message) || !resolve(message)) {
+		return false;
+	}
+
+	origin = 0;
+	qint32 end = 0;
+	for (qint32 i = 0; i < steps.size(); ++i) {
+		origin = std::min(origin, steps[i].t - 1);
+		end = std::max(end, steps[i].t + duration(steps[i]) + 2);
+	}
+	horizon = end - origin + 1;
+	halo.fill(0, horizon * rows * columns);
+	arrivals.fill(0, horizon * rows * columns);
+	waiting.clear();
+
+	// Occupancy of the original protocol, which a Mix finished early must keep clear of during its original loop
+	for (qint32 i = 0; i < steps.size(); ++i) {
+		commit(steps[i], steps[i].t);
+	}
+	for (qint32 i = 0; i < waiting.size(); ++i) {
+		const Track &track = tracks[waiting[i]];
+		for (qint32 s = track.last + 1; s < end; ++s) {
+			reserve(Entry{s, track.cell, false});
+		}
+	}
+	originalHalo = halo;
+	originalArrivals = arrivals;
+	halo.fill(0);
+	arrivals.fill(0);
+	waiting.clear();
+
+	QVector<qint32> placed(steps.size());
+	QVector<Entry> entries;
+	QVector<Track> results;
+	for (qint32 i = 0; i < steps.size(); ++i) {
+		const Step &step = steps[i];
+		qint32 ready = step.type == CommandType::Input ? 0 : std::numeric_limits<qint32>::min();
+		for (qint32 j = 0; j < step.subjects.size(); ++j) {
+			ready = std::max(ready, tracks[step.subjects[j]].ready);
+		}
+
+		// The original second is always free: every droplet placed so far is where it was back then, or already
+		// further and within the cells it took at that time. A Mix finished early is the exception, checked apart.
+		qint32 t = step.t;
+		for (qint32 s = std::min(ready, step.t); s < step.t; ++s) {
+			if (step.type == CommandType::Mix && (s + duration(step) > step.t || !clearOfLoop(step))) break;
+			place(step, s, entries, results);
+			if (feasible(step, entries, results)) {
+				t = s;
+				break;
+			}
+		}
+		commit(step, t);
+
+		placed[i] = t;
+		if (t < step.t) {
+			++shifted;
+		}
+	}
+
+	QVector<qint32> order(steps.size());
+	for (qint32 i = 0; i < steps.size(); ++i) {
+		order[i] = i;
+	}
+	std::stable_sort(order.begin(), order.end(), [&](qint32 a, qint32 b) -> bool { return placed[a] < placed[b]; });
+	for (qint32 i = 0; i < order.size(); ++i) {
+		commands.push_back(text(steps[order[i]], placed[order[i]]));
+	}
+	return true;
+}
+
+qint32 CommandCompactor::shiftedCommands() const {
+	return shifted;
+}
+
+bool CommandCompactor::parse(const QString &url, QString &message) {
+	QFile file(url);
+	if (!file.open(QFile::ReadOnly | QFile::Text)) {
+		message = QString("Cannot open %1.").arg(url);
+		return false;
+	}
+	QTextStream fs(&file);
+
+	// Macros, Repeat blocks and includes are expanded, and the compacted file has their commands one by one
+	steps.clear();
+	auto add = [this](const CommandRecord &record, QString &message) -> bool {
+		const QVector<qint32> &values = record.values;
+		Step step;
+		step.line = record.line + 1;
+		qint32 count = -1; // number of cells, -1 for any number of at least two
+		if (record.name == "input") {
+			step.type = CommandType::Input;
+			count = 1;
+		} else if (record.name == "output") {
+			step.type = CommandType::Output;
+			count = 1;
+		} else if (record.name == "move") {
+			step.type = CommandType::Move;
+			count = 2;
+		} else if (record.name == "mix") {
+			step.type = CommandType::Mix;
+		} else if (record.name == "merge") {
+			step.type = CommandType::Merging;
+			count = 2;
+		} else if (record.name == "split") {
+			step.type = CommandType::Splitting;
+			count = 3;
+		} else {
+			return true; // ignored by loadFile as well
+		}
+
+		if (values.size() % 2 != 1 || (count >= 0 && values.size() != count * 2 + 1) || (count < 0 && values.size() < 5)) {
+			message = QString("Line %1: wrong number of values.").arg(step.line);
+			return false;
+		}
+		step.t = values[0];
+		for (qint32 i = 1; i < values.size(); i += 2) {
+			qint32 x = values[i] - 1, y = rows - values[i + 1];
+			if (x < 0 || x >= columns || y < 0 || y >= rows) {
+				message = QString("Line %1: position (%2, %3) out of grid.").arg(step.line).arg(x + 1).arg(rows - y);
+				return false;
+			}
+			step.cells.push_back(cellAt(x, y));
+		}
+		if (step.type == CommandType::Merging) {
+			// The merged droplet appears halfway, rounded the same way as in loadFile
+			step.cells.push_back(cellAt((values[1] + values[3] - 2) / 2, (rows * 2 - values[2] - values[4]) / 2));
+		}
+		steps.push_back(step);
+		return true;
+	};
+
+	CommandExpander expander(url);
+	for (qint32 line = 0; !fs.atEnd(); ++line) {
+		if (!expander.feed(fs.readLine(), line, add, message)) return false;
+	}
+	if (!expander.finish(message)) return false;
+
+	std::stable_sort(steps.begin(), steps.end(), [](const Step &a, const Step &b) -> bool { return a.t < b.t; });
+	return true;
+}
+
+bool CommandCompactor::resolve(QString &message) {
+	// Replaying the original file: cell -> (droplet, second from which loadFile finds it there). A droplet is
+	// found in the second of the move that brings it, so a later Mix may already be heading for the same cell.
+	QHash<qint32, QVector<QPair<qint32, qint32>>> dropletsAt;
+	QVector<QPair<qint32, qint32>> leftBy; // droplet -> (step, index among the results) of the command which left it
+	qint32 droplets = 0;
+
+	for (qint32 i = 0; i < steps.size(); ++i) {
+		Step &step = steps[i];
+
+		auto take = [&](qint32 cell) -> bool {
+			QVector<QPair<qint32, qint32>> &here = dropletsAt[cell];
+			qint32 k = -1;
+			for (qint32 j = 0; j < here.size(); ++j) {
+				if (here[j].second <= step.t + 1 && (k < 0 || here[j].second < here[k].second)) {
+					k = j;
+				}
+			}
+			if (k < 0) {
+				message = QString("Line %1: no droplet at (%2, %3).").arg(step.line).arg(cell / rows + 1).arg(rows - cell % rows);
+				return false;
+			}
+			qint32 d = here[k].first;
+			here.remove(k);
+			step.subjects.push_back(d);
+			steps[leftBy[d].first].until[leftBy[d].second] = step.t;
+			return true;
+		};
+		auto leave = [&](qint32 d, qint32 cell, qint32 from) {
+			if (d == leftBy.size()) {
+				leftBy.push_back(qMakePair(i, step.results.size()));
+			} else {
+				leftBy[d] = qMakePair(i, step.results.size());
+			}
+			step.results.push_back(d);
+			step.until.push_back(never);
+			dropletsAt[cell].push_back(qMakePair(d, from));
+		};
+
+		if (step.type == CommandType::Input) {
+			leave(droplets++, step.cells[0], step.t);
+		} else if (step.type == CommandType::Output) {
+			if (!take(step.cells[0])) return false;
+		} else if (step.type == CommandType::Move || step.type == CommandType::Mix) {
+			if (!take(step.cells[0])) return false;
+			leave(step.subjects[0], step.cells.back(), step.t + duration(step));
+		} else if (step.type == CommandType::Merging) {
+			if (!take(step.cells[0]) || !take(step.cells[1])) return false;
+			leave(droplets++, step.cells[2], step.t + 1);
+		} else if (step.type == CommandType::Splitting) {
+			if (!take(step.cells[0])) return false;
+			leave(droplets++, step.cells[1], step.t + 1);
+			leave(droplets++, step.cells[2], step.t + 1);
+		}
+	}
+
+	tracks.resize(droplets);
+	return true;
+}
+
+// Cells taken by the command started at second t, from t + 1 on (from t for Input), and the droplets it leaves
+void CommandCompactor::place(const Step &step, qint32 t, QVector<Entry> &entries, QVector<Track> &results) const {
+	entries.clear();
+	results.clear();
+	auto leave = [&](qint32 cell, qint32 last, qint32 ready) {
+		results.push_back(Track{cell, last, step.until[results.size()], ready});
+	};
+
+	if (step.type == CommandType::Input) {
+		entries.push_back(Entry{t, step.cells[0], false});
+		leave(step.cells[0], t, t + 1); // not moved in the second it appears, loadFile sorts by time only
+	} else if (step.type == CommandType::Move || step.type == CommandType::Mix) {
+		for (qint32 i = 1; i < step.cells.size(); ++i) {
+			entries.push_back(Entry{t + i, step.cells[i], true});
+		}
+		leave(step.cells.back(), t + step.cells.size() - 1, t + step.cells.size() - 1);
+	} else if (step.type == CommandType::Merging) {
+		for (qint32 i = 0; i < 3; ++i) {
+			entries.push_back(Entry{t + 1, step.cells[i], false});
+		}
+		entries.push_back(Entry{t + 2, step.cells[2], false});
+		leave(step.cells[2], t + 2, t + 2);
+	} else if (step.type == CommandType::Splitting) {
+		entries.push_back(Entry{t + 1, step.cells[0], false});
+		entries.push_back(Entry{t + 1, step.cells[1], true});
+		entries.push_back(Entry{t + 1, step.cells[2], true});
+		entries.push_back(Entry{t + 2, step.cells[1], false});
+		entries.push_back(Entry{t + 2, step.cells[2], false});
+		leave(step.cells[1], t + 2, t + 2);
+		leave(step.cells[2], t + 2, t + 2);
+	}
+}
+
+void CommandCompactor::commit(const Step &step, qint32 t) {
+	QVector<Entry> entries;
+	QVector<Track> results;
+	place(step, t, entries, results);
+	for (qint32 j = 0; j < step.subjects.size(); ++j) {
+		const Track &track = tracks[step.subjects[j]];
+		for (qint32 s = track.last + 1; s <= t; ++s) {
+			reserve(Entry{s, track.cell, false});
+		}
+		waiting.removeOne(step.subjects[j]);
+	}
+	for (qint32 j = 0; j < entries.size(); ++j) {
+		reserve(entries[j]);
+	}
+	for (qint32 j = 0; j < results.size(); ++j) {
+		tracks[step.results[j]] = results[j];
+		waiting.push_back(step.results[j]);
+	}
+}
+
+// Whether the cell a Mix ends on is clear of the original protocol while the Mix originally runs, so that it
+// may wait there instead of looping when the later commands take place
+bool CommandCompactor::clearOfLoop(const Step &step) const {
+	const qint32 area = rows * columns;
+	qint32 cell = step.cells.back();
+	auto near = [&](qint32 other) -> qint32 {
+		return abs(other / rows - cell / rows) <= 1 && abs(other % rows - cell % rows) <= 1 ? 1 : 0;
+	};
+	for (qint32 i = 0; i + 1 < step.cells.size(); ++i) {
+		qint32 s = step.t + i - origin;
+		// minus the droplet itself, on the i-th cell of the loop and just moved to the next one
+		if (originalHalo[s * area + cell] > near(step.cells[i]) || originalArrivals[(s + 1) * area + cell] > near(step.cells[i + 1])) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// The waiting of the subjects up to the start of the command has been checked while they were waiting, so only
+// the cells taken from then on are checked: against every droplet at the same second (static), and the cells just
+// moved to against every droplet a second before, the other way round as well (dynamic)
+bool CommandCompactor::feasible(const Step &step, const QVector<Entry> &entries, const QVector<Track> &results) const {
+	const qint32 area = rows * columns;
+	for (qint32 i = 0; i < entries.size(); ++i) {
+		const Entry &e = entries[i];
+		qint32 s = e.t - origin;
+		if (halo[s * area + e.cell] > 0 || arrivals[(s + 1) * area + e.cell] > 0 || waitsNear(e.cell, e.t, step)) {
+			return false;
+		}
+		if (e.arrival) {
+			qint32 near = halo[(s - 1) * area + e.cell];
+			for (qint32 j = 0; j < step.subjects.size(); ++j) {
+				const Track &track = tracks[step.subjects[j]];
+				if (track.last == e.t - 1 && abs(track.cell / rows - e.cell / rows) <= 1 && abs(track.cell % rows - e.cell % rows) <= 1) {
+					--near; // the droplet itself
+				}
+			}
+			if (near > 0 || waitsNear(e.cell, e.t - 1, step)) {
+				return false;
+			}
+		}
+	}
+
+	for (qint32 i = 0; i < results.size(); ++i) {
+		const Track &r = results[i];
+		qint32 until = std::min(r.until, horizon + origin - 2);
+		for (qint32 t = r.last + 1; t <= until; ++t) {
+			qint32 s = t - origin;
+			if (halo[s * area + r.cell] > 0 || arrivals[(s + 1) * area + r.cell] > 0) {
+				return false;
+			}
+		}
+		for (qint32 j = 0; j < waiting.size(); ++j) {
+			const Track &w = tracks[waiting[j]];
+			if (step.subjects.contains(waiting[j])) continue;
+			if (abs(w.cell / rows - r.cell / rows) <= 1 && abs(w.cell % rows - r.cell % rows) <= 1 && w.last < r.until && r.last < w.until) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+// Whether a waiting droplet other than the subjects of the step is within distance 1 of the cell at second t
+bool CommandCompactor::waitsNear(qint32 cell, qint32 t, const Step &step) const {
+	for (qint32 i = 0; i < waiting.size(); ++i) {
+		const Track &w = tracks[waiting[i]];
+		if (w.last < t && t <= w.until && abs(w.cell / rows - cell / rows) <= 1 && abs(w.cell % rows - cell % rows) <= 1 && !step.subjects.contains(waiting[i])) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void CommandCompactor::reserve(const Entry &entry) {
+	const qint32 area = rows * columns;
+	qint32 x = entry.cell / rows, y = entry.cell % rows, s = entry.t - origin;
+	for (qint32 xx = std::max(x - 1, 0); xx <= std::min(x + 1, columns - 1); ++xx) {
+		for (qint32 yy = std::max(y - 1, 0); yy <= std::min(y + 1, rows - 1); ++yy) {
+			++halo[s * area + xx * rows + yy];
+			if (entry.arrival) {
+				++arrivals[s * area + xx * rows + yy];
+			}
+		}
+	}
+}
+
+qint32 CommandCompactor::duration(const Step &step) const {
+	switch (step.type) {
+	case CommandType::Move:
+		return 1;
+	case CommandType::Mix:
+		return step.cells.size() - 1;
+	case CommandType::Merging:
+	case CommandType::Splitting:
+		return 2;
+	default:
+		return 0;
+	}
+}
+
+qint32 CommandCompactor::cellAt(qint32 x, qint32 y) const {
+	return x * rows + y;
+}
+
+QString CommandCompactor::text(const Step &step, qint32 t) const {
+	static const QMap<CommandType, QString> names({
+		{CommandType::Input, "Input"}, {CommandType::Output, "Output"}, {CommandType::Move, "Move"},
+		{CommandType::Mix, "Mix"}, {CommandType::Merging, "Merge"}, {CommandType::Splitting, "Split"}
+	});
+	qint32 count = step.type == CommandType::Merging ? 2 : step.cells.size();
+	QString line = QString("%1 %2").arg(names.value(step.type)).arg(t);
+	for (qint32 i = 0; i < count; ++i) {
+		line += QString(",%1,%2").arg(step.cells[i] / rows + 1).arg(rows - step.cells[i] % rows);
+	}
+	return line + ";";
+}
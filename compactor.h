@@ -0,0 +1,70 @@
+#ifndef COMPACTOR_H
+#define COMPACTOR_H
+
+#include <QVector>
+#include <QStringList>
+
+#include "utility.h"
+
+// Shortens a valid command file by pulling every command to the earliest second at which its droplets are
+// ready and the static and dynamic distance constraints still hold. Commands are taken in the order of time
+// and keep their positions, so the droplets travel the same paths and only wait less. A droplet is assumed to
+// wait at most until the original second of its next command, which keeps that second free for the command:
+// the compacted protocol never takes longer than the original one.
+
+class CommandCompactor {
+public:
+	CommandCompactor();
+
+	// On success commands holds the lines of the compacted command file, sorted by time
+	bool compact(const QString &url, const ChipConfig &config, QStringList &commands, QString &message);
+
+	qint32 shiftedCommands() const; // number of commands moved to an earlier second
+
+private:
+	struct Step {
+		CommandType type; // Input, Output, Move, Mix, Merging or Splitting
+		qint32 t; // original second
+		qint32 line;
+		QVector<qint32> cells; // cells in the order of the command
+		QVector<qint32> subjects, results; // droplets the command takes and leaves
+		QVector<qint32> until; // original second of the next command of each result
+	};
+
+	// A droplet on cell at second t, which has just moved there if arrival is set
+	struct Entry {
+		qint32 t, cell;
+		bool arrival;
+	};
+
+	// A droplet between its commands: it is on cell at second last and waits there until second until
+	struct Track {
+		qint32 cell, last, until;
+		qint32 ready; // earliest second of its next command
+	};
+
+	bool parse(const QString &url, QString &message);
+	bool resolve(QString &message);
+	void place(const Step &step, qint32 t, QVector<Entry> &entries, QVector<Track> &results) const;
+	bool feasible(const Step &step, const QVector<Entry> &entries, const QVector<Track> &results) const;
+	bool clearOfLoop(const Step &step) const;
+	bool waitsNear(qint32 cell, qint32 t, const Step &step) const;
+	void commit(const Step &step, qint32 t);
+	void reserve(const Entry &entry);
+	qint32 duration(const Step &step) const;
+	qint32 cellAt(qint32 x, qint32 y) const;
+	QString text(const Step &step, qint32 t) const;
+
+	qint32 rows, columns;
+	qint32 horizon; // seconds covered by the occupancy grids
+	qint32 origin; // second of the first row of the grids
+	QVector<Step> steps;
+	QVector<Track> tracks; // by droplet
+	QVector<qint32> waiting; // droplets on the chip
+	QVector<qint32> halo; // [t * rows * columns + cell]: droplets within distance 1 of the cell at second t
+	QVector<qint32> arrivals; // the same, counting only the droplets that have just moved
+	QVector<qint32> originalHalo, originalArrivals; // the grids of the original protocol
+	qint32 shifted;
+};
+
+#endif // COMPACTOR_H
@@ -4,7 +4,7 @@
 #
 #-------------------------------------------------
 
-QT       += core gui multimedia
+QT       += core gui multimedia network
 
 greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 
@@ -24,22 +24,41 @@ DEFINES += QT_DEPRECATED_WARNINGS
 
 CONFIG += c++11
 
+# Uncomment to compile out the timers of the profiler overlay and of traces.
+#DEFINES += DMFB_NO_PROFILER
+
 SOURCES += \
+        compactor.cpp \
         dlgabout.cpp \
         dlgnewchip.cpp \
+        expander.cpp \
         frmconfigchip.cpp \
+        liveinput.cpp \
+        loadworker.cpp \
         main.cpp \
         mainwindow.cpp \
+        profiler.cpp \
+        router.cpp \
+        soundmixer.cpp \
         ui.cpp \
-        utility.cpp
+        utility.cpp \
+        washplanner.cpp
 
 HEADERS += \
+        compactor.h \
         dlgabout.h \
         dlgnewchip.h \
+        expander.h \
         frmconfigchip.h \
+        liveinput.h \
+        loadworker.h \
         mainwindow.h \
+        profiler.h \
+        router.h \
+        soundmixer.h \
         ui.h \
-        utility.h
+        utility.h \
+        washplanner.h
 
 FORMS += \
         dlgabout.ui \
@@ -0,0 +1,313 @@
+#include "expander.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+
+CommandExpander::CommandExpander(const QString &url) : expanded(0), directives(false) {
+	main.folder = QFileInfo(url).absolutePath();
+	main.line = 0;
+	main.offset = 0;
+	main.depth = 0;
+	if (!url.isEmpty()) {
+		active.push_back(QFileInfo(url).canonicalFilePath());
+	}
+}
+
+bool CommandExpander::feed(const QString &text, qint32 line, const Sink &sink, QString &message) {
+	main.line = line;
+	return feedLine(text, line, main, sink, message);
+}
+
+bool CommandExpander::finish(QString &message) {
+	if (!blocks.empty()) {
+		message = QString("%1: %2 has no End.").arg(blocks.back().where, blocks.back().type == RepeatItem ? "Repeat" : "Macro");
+		return false;
+	}
+	return true;
+}
+
+bool CommandExpander::usedDirectives() const {
+	return directives;
+}
+
+QStringList CommandExpander::includedFiles() const {
+	return included;
+}
+
+bool CommandExpander::feedLine(const QString &text, qint32 fileLine, Source &source, const Sink &sink, QString &message) {
+	QStringList tokens = QString(text).replace(',', ' ').replace(';', ' ').simplified().split(' ', QString::SkipEmptyParts);
+	if (tokens.empty()) return true;
+	QString name = tokens[0].toLower();
+
+	// Commands outside blocks are the most of most files, and go straight to the sink
+	if (blocks.empty() && name != "macro" && name != "end" && name != "repeat" && name != "call" && name != "include") {
+		// Those of included files count towards the expansion, as a file may be included any number of times
+		if (source.depth > 0 && ++expanded > maxExpandedCommands) {
+			message = QString("%1: the expansion makes more than %2 commands.").arg(place(source, fileLine)).arg(maxExpandedCommands);
+			return false;
+		}
+		record.name = name;
+		record.values.resize(tokens.size() - 1);
+		for (qint32 i = 1; i < tokens.size(); ++i) {
+			record.values[i - 1] = tokens[i].toInt();
+		}
+		if (!record.values.empty()) {
+			record.values[0] += source.offset;
+		}
+		record.line = source.line;
+		return sink(record, message);
+	}
+
+	QString where = place(source, fileLine);
+	const QStringList &parameters = blocks.empty() ? QStringList() : blocks.front().parameters; // macros are only outside blocks
+
+	if (name == "macro") {
+		directives = true;
+		if (!blocks.empty()) {
+			message = QString("%1: a macro is defined inside a block.").arg(where);
+			return false;
+		}
+		OpenBlock block{CommandItem, items.size(), tokens.size() > 1 ? tokens[1].toLower() : QString(), QStringList(), where, source.line};
+		if (!isName(block.name)) {
+			message = QString("%1: the macro needs a name.").arg(where);
+			return false;
+		}
+		if (macros.contains(block.name)) {
+			message = QString("%1: macro %2 is defined twice.").arg(where, block.name);
+			return false;
+		}
+		for (qint32 i = 2; i < tokens.size(); ++i) {
+			QString parameter = tokens[i].toLower();
+			if (!isName(parameter) || block.parameters.contains(parameter)) {
+				message = QString("%1: cannot take %2 as a parameter.").arg(where, tokens[i]);
+				return false;
+			}
+			block.parameters.push_back(parameter);
+		}
+		blocks.push_back(block);
+		return true;
+	}
+
+	if (name == "end") {
+		directives = true;
+		if (blocks.empty()) {
+			message = QString("%1: End without Macro or Repeat.").arg(where);
+			return false;
+		}
+		OpenBlock block = blocks.takeLast();
+		if (block.type == CommandItem) {
+			macros.insert(block.name, Macro{block.parameters, block.first, items.size()});
+			return true;
+		}
+		items[block.first].end = items.size();
+		if (!blocks.empty()) return true;
+
+		// A block outside the others is expanded at once, then forgotten
+		bool ok = expand(block.first, items.size(), QVector<qint32>(), source.offset, block.line, source.depth, sink, message);
+		items.resize(block.first);
+		return ok;
+	}
+
+	if (name == "include") {
+		directives = true;
+		if (!blocks.empty()) {
+			message = QString("%1: Include is used inside a block.").arg(where);
+			return false;
+		}
+		Expression offset;
+		if (tokens.size() < 2 || tokens.size() > 3 || (tokens.size() == 3 && !parseExpression(tokens[2].toLower(), QStringList(), offset))) {
+			message = QString("%1: Include needs a file, and may have a time.").arg(where);
+			return false;
+		}
+		return include(tokens[1], source.offset + evaluate(offset, QVector<qint32>()), source, where, sink, message);
+	}
+
+	Item item{name == "repeat" ? RepeatItem : name == "call" ? CallItem : CommandItem, name, QVector<Expression>(), -1, where};
+	if (item.type == CallItem) {
+		if (tokens.size() < 3) {
+			message = QString("%1: Call needs a macro and a time.").arg(where);
+			return false;
+		}
+		item.name = tokens[1].toLower();
+	}
+	if (!parseValues(tokens, item.type == CallItem ? 2 : 1, parameters, where, item.values, message)) return false;
+
+	if (item.type == RepeatItem) {
+		directives = true;
+		if (item.values.size() != 2) {
+			message = QString("%1: Repeat needs a count and an interval.").arg(where);
+			return false;
+		}
+		blocks.push_back(OpenBlock{RepeatItem, items.size(), QString(), QStringList(), where, source.line});
+	}
+	items.push_back(item);
+	if (item.type != CallItem || !blocks.empty()) return true;
+
+	directives = true;
+	bool ok = expand(items.size() - 1, items.size(), QVector<qint32>(), source.offset, source.line, source.depth, sink, message);
+	items.pop_back();
+	return ok;
+}
+
+bool CommandExpander::include(const QString &file, qint32 offset, const Source &from, const QString &where, const Sink &sink, QString &message) {
+	if (from.depth >= maxDepth) {
+		message = QString("%1: includes are nested more than %2 deep.").arg(where).arg(maxDepth);
+		return false;
+	}
+	if (++expanded > maxExpandedCommands) {
+		message = QString("%1: the expansion makes more than %2 commands.").arg(where).arg(maxExpandedCommands);
+		return false;
+	}
+	QFileInfo info(QDir(from.folder).filePath(file));
+	QFile f(info.filePath());
+	if (!f.open(QFile::ReadOnly)) {
+		message = QString("%1: cannot open %2.").arg(where, file);
+		return false;
+	}
+	QString path = info.canonicalFilePath();
+	if (active.contains(path)) {
+		message = QString("%1: %2 includes itself.").arg(where, file);
+		return false;
+	}
+	if (!included.contains(path)) {
+		included.push_back(path);
+	}
+
+	Source source{info.absolutePath(), info.fileName(), from.line, offset, from.depth + 1};
+	QByteArray text = f.readAll();
+	active.push_back(path);
+	for (qint32 begin = 0, line = 0; begin < text.size(); ++line) {
+		qint32 next = text.indexOf('\n', begin);
+		if (next < 0) {
+			next = text.size();
+		}
+		if (!feedLine(QString::fromUtf8(text.constData() + begin, next - begin), line, source, sink, message)) {
+			active.pop_back();
+			return false;
+		}
+		begin = next + 1;
+	}
+	active.pop_back();
+	if (!blocks.empty()) {
+		message = QString("%1: %2 has no End.").arg(blocks.back().where, blocks.back().type == RepeatItem ? "Repeat" : "Macro");
+		return false;
+	}
+	return true;
+}
+
+bool CommandExpander::expand(qint32 first, qint32 end, const QVector<qint32> &parameters, qint32 offset, qint32 line, qint32 depth, const Sink &sink, QString &message) {
+	for (qint32 i = first; i < end;) {
+		const Item &item = items.at(i);
+		if (++expanded > maxExpandedCommands) {
+			message = QString("%1: the expansion makes more than %2 commands.").arg(item.where).arg(maxExpandedCommands);
+			return false;
+		}
+
+		if (item.type == CommandItem) {
+			record.name = item.name;
+			record.values.resize(item.values.size());
+			for (qint32 k = 0; k < item.values.size(); ++k) {
+				record.values[k] = evaluate(item.values[k], parameters);
+			}
+			if (!record.values.empty()) {
+				record.values[0] += offset;
+			}
+			record.line = line;
+			if (!sink(record, message)) return false;
+			++i;
+		} else if (item.type == RepeatItem) {
+			qint32 n = evaluate(item.values[0], parameters), dt = evaluate(item.values[1], parameters);
+			if (n < 0) {
+				message = QString("%1: cannot repeat %2 times.").arg(item.where).arg(n);
+				return false;
+			}
+			for (qint32 k = 0; k < n; ++k) {
+				if (!expand(i + 1, item.end, parameters, offset + k * dt, line, depth, sink, message)) return false;
+			}
+			i = item.end;
+		} else {
+			auto macro = macros.constFind(item.name);
+			if (macro == macros.constEnd()) {
+				message = QString("%1: there is no macro %2.").arg(item.where, item.name);
+				return false;
+			}
+			if (item.values.size() - 1 != macro->parameters.size()) {
+				message = QString("%1: macro %2 needs %3 value(s) after the time.").arg(item.where, item.name).arg(macro->parameters.size());
+				return false;
+			}
+			if (depth >= maxDepth) {
+				message = QString("%1: calls are nested more than %2 deep.").arg(item.where).arg(maxDepth);
+				return false;
+			}
+			QVector<qint32> arguments(macro->parameters.size());
+			for (qint32 k = 0; k < arguments.size(); ++k) {
+				arguments[k] = evaluate(item.values[k + 1], parameters);
+			}
+			if (!expand(macro->first, macro->end, arguments, offset + evaluate(item.values[0], parameters), line, depth + 1, sink, message)) return false;
+			++i;
+		}
+	}
+	return true;
+}
+
+bool CommandExpander::parseValues(const QStringList &tokens, qint32 from, const QStringList &parameters, const QString &where, QVector<Expression> &values, QString &message) const {
+	values.clear();
+	for (qint32 i = from; i < tokens.size(); ++i) {
+		Expression e;
+		if (!parseExpression(tokens[i].toLower(), parameters, e)) {
+			message = QString("%1: cannot read %2.").arg(where, tokens[i]);
+			return false;
+		}
+		values.push_back(e);
+	}
+	return true;
+}
+
+// Sums and differences of numbers and parameters, such as x+1 or -t+2
+bool CommandExpander::parseExpression(const QString &s, const QStringList &parameters, Expression &e) {
+	e.clear();
+	for (qint32 i = 0; i < s.size();) {
+		if (!e.empty() && s[i] != '+' && s[i] != '-') return false;
+		qint32 factor = 1;
+		for (; i < s.size() && (s[i] == '+' || s[i] == '-'); ++i) {
+			if (s[i] == '-') {
+				factor = -factor;
+			}
+		}
+		qint32 start = i;
+		if (i < s.size() && s[i].isDigit()) {
+			for (; i < s.size() && s[i].isDigit(); ++i);
+			bool ok = false;
+			e.push_back(Term{factor, s.mid(start, i - start).toInt(&ok), -1});
+			if (!ok) return false;
+		} else {
+			for (; i < s.size() && (s[i].isLetterOrNumber() || s[i] == '_'); ++i);
+			qint32 parameter = parameters.indexOf(s.mid(start, i - start));
+			if (i == start || parameter < 0) return false;
+			e.push_back(Term{factor, 0, parameter});
+		}
+	}
+	return !e.empty();
+}
+
+qint32 CommandExpander::evaluate(const Expression &e, const QVector<qint32> &parameters) {
+	qint32 value = 0;
+	for (const Term &term : e) {
+		value += term.factor * (term.parameter < 0 ? term.value : parameters[term.parameter]);
+	}
+	return value;
+}
+
+bool CommandExpander::isName(const QString &s) {
+	if (s.isEmpty() || s[0].isDigit()) return false;
+	for (QChar c : s) {
+		if (!c.isLetterOrNumber() && c != '_') return false;
+	}
+	return true;
+}
+
+QString CommandExpander::place(const Source &source, qint32 fileLine) {
+	if (source.name.isEmpty()) return QString("Line %1").arg(fileLine + 1);
+	return QString("%1, line %2").arg(source.name).arg(fileLine + 1);
+}
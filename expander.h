@@ -0,0 +1,104 @@
+#ifndef EXPANDER_H
+#define EXPANDER_H
+
+#include <functional>
+
+#include <QMap>
+#include <QString>
+#include <QVector>
+#include <QStringList>
+
+// Directives of command files, expanded into plain commands while the file is read:
+//   Macro name p1, p2, ...;  ...  End;   commands with times from the start of the call, and values such as x+1 or t-2
+//   Call name t, v1, v2, ...;             the commands of a macro from second t, its parameters set to the values
+//   Repeat n, dt;  ...  End;              n copies of the commands in between, each dt seconds after the one before
+//   Include file;  or  Include file, t;   the commands of another file (from the folder of this one), t seconds later
+// Blocks nest and macros call other macros, but macros are defined outside blocks. Blocks are kept as parsed
+// templates, and their commands are handed to the sink one by one while they are expanded, so the expanded text is
+// never built.
+
+struct CommandRecord {
+	QString name; // in lower case
+	QVector<qint32> values; // the second, then the coordinates, as in the file
+	qint32 line; // line of the main file whose statement gives the command
+};
+
+class CommandExpander {
+public:
+	typedef std::function<bool(const CommandRecord &record, QString &message)> Sink; // false stops the expansion
+
+	explicit CommandExpander(const QString &url);
+
+	// A line of the main file, counted from 0; plain commands outside blocks go to the sink at once
+	bool feed(const QString &text, qint32 line, const Sink &sink, QString &message);
+	bool finish(QString &message); // checks that every block is closed
+
+	bool usedDirectives() const;
+	QStringList includedFiles() const;
+
+private:
+	struct Term {
+		qint32 factor; // 1 or -1
+		qint32 value;
+		qint32 parameter; // index among the parameters of the macro, -1 for the constant value
+	};
+	typedef QVector<Term> Expression;
+
+	enum ItemType {
+		CommandItem, RepeatItem, CallItem
+	};
+
+	struct Item {
+		ItemType type;
+		QString name; // of the command or of the macro called
+		QVector<Expression> values; // Repeat: the count and the interval
+		qint32 end; // Repeat: index after the last item of the block
+		QString where; // for messages
+	};
+
+	struct Macro {
+		QStringList parameters;
+		qint32 first, end; // items of the body
+	};
+
+	struct OpenBlock {
+		ItemType type; // CommandItem for a macro
+		qint32 first; // Repeat: its item; macro: the first item of the body
+		QString name; // of the macro
+		QStringList parameters;
+		QString where;
+		qint32 line; // of the main file
+	};
+
+	// Where the lines being read come from
+	struct Source {
+		QString folder, name; // name is empty for the main file
+		qint32 line; // of the main file, for the records
+		qint32 offset; // seconds added to the commands
+		qint32 depth;
+	};
+
+	static const qint32 maxDepth = 32; // nested calls or includes
+	static const qint32 maxExpandedCommands = 1 << 24;
+
+	bool feedLine(const QString &text, qint32 fileLine, Source &source, const Sink &sink, QString &message);
+	bool include(const QString &file, qint32 offset, const Source &from, const QString &where, const Sink &sink, QString &message);
+	bool expand(qint32 first, qint32 end, const QVector<qint32> &parameters, qint32 offset, qint32 line, qint32 depth, const Sink &sink, QString &message);
+	bool parseValues(const QStringList &tokens, qint32 from, const QStringList &parameters, const QString &where, QVector<Expression> &values, QString &message) const;
+	static bool parseExpression(const QString &s, const QStringList &parameters, Expression &e);
+	static qint32 evaluate(const Expression &e, const QVector<qint32> &parameters);
+	static bool isName(const QString &s);
+	static QString place(const Source &source, qint32 fileLine);
+
+	Source main;
+	QVector<Item> items; // bodies of the macros, then the open blocks
+	QMap<QString, Macro> macros;
+	QVector<OpenBlock> blocks;
+	QStringList included;
+	QStringList active; // the main file and the files being included, to find cycles
+	qint64 expanded; // commands, copies of blocks and included files made by the expansion
+	bool directives;
+	CommandRecord record;
+};
+
+#endif // EXPANDER_H
@@ -48,8 +48,8 @@ void frmConfigChip::on_buttonBox_accepted() {
 		QMessageBox::warning(this, tr("Warning"), tr("Please specify exactly one output port."));
 	} else if (count[PortType::wash] == 0 && count[PortType::waste] != 0) {
 		QMessageBox::warning(this, tr("Warning"), tr("Waste port is not allowed without wash input port."));
-	} else if (count[PortType::wash] != 0 && count[PortType::waste] != 1) {
-		QMessageBox::warning(this, tr("Warning"), tr("Please specify exactly one waste port with wash input port."));
+	} else if (count[PortType::wash] != 0 && count[PortType::waste] == 0) {
+		QMessageBox::warning(this, tr("Warning"), tr("Please specify at least one waste port with wash input port."));
 	} else {
 		config.hasWash = (count[PortType::wash] > 0);
 		this->close();
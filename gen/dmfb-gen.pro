@@ -0,0 +1,28 @@
+#-------------------------------------------------
+#
+# Generator of long valid protocols, built from the sources of dmfb
+#
+#-------------------------------------------------
+
+QT       += core gui widgets
+
+TARGET = dmfb-gen
+TEMPLATE = app
+
+CONFIG += c++11 console
+CONFIG -= app_bundle
+
+DEFINES += QT_DEPRECATED_WARNINGS
+
+INCLUDEPATH += ..
+
+SOURCES += \
+        main.cpp \
+        ../expander.cpp \
+        ../generator.cpp \
+        ../utility.cpp
+
+HEADERS += \
+        ../expander.h \
+        ../generator.h \
+        ../utility.h
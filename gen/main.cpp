@@ -0,0 +1,65 @@
+#include <QFile>
+#include <QTextStream>
+#include <QCoreApplication>
+#include <QCommandLineParser>
+
+#include "utility.h"
+#include "generator.h"
+
+// Writes a random valid command file and the chip configuration it runs on:
+//   dmfb-gen [options] <command file> <chip file>
+
+int main(int argc, char *argv[]) {
+	QCoreApplication a(argc, argv);
+	QCoreApplication::setApplicationName("dmfb-gen");
+
+	GeneratorSettings settings;
+	QCommandLineParser parser;
+	parser.setApplicationDescription("Generates a long valid protocol for scaling tests.");
+	parser.addHelpOption();
+	parser.addPositionalArgument("commands", "Command file to write.");
+	parser.addPositionalArgument("chip", "Chip configuration file to write.");
+	QCommandLineOption rows("rows", "Rows of the chip.", "n", QString::number(settings.rows));
+	QCommandLineOption droplets("droplets", "Concurrent droplets; the chip has 4 columns per droplet but the last.", "n", QString::number(settings.droplets));
+	QCommandLineOption length("length", "Number of commands; droplets on the chip are still taken to the output.", "n", QString::number(settings.commands));
+	QCommandLineOption move("move", "Relative frequency of Move.", "weight", QString::number(settings.moveWeight));
+	QCommandLineOption mix("mix", "Relative frequency of Mix.", "weight", QString::number(settings.mixWeight));
+	QCommandLineOption split("split", "Relative frequency of Split, each followed by a Merge.", "weight", QString::number(settings.splitWeight));
+	QCommandLineOption mixSteps("mix-steps", "Longest Mix.", "n", QString::number(settings.mixSteps));
+	QCommandLineOption lifetime("lifetime", "Mean number of operations of a droplet.", "n", QString::number(settings.lifetime));
+	QCommandLineOption seed("seed", "Seed of the random choices.", "n", QString::number(settings.seed));
+	parser.addOptions({rows, droplets, length, move, mix, split, mixSteps, lifetime, seed});
+	parser.process(a);
+
+	QStringList files = parser.positionalArguments();
+	if (files.size() != 2) {
+		parser.showHelp(1);
+	}
+	settings.rows = parser.value(rows).toInt();
+	settings.droplets = parser.value(droplets).toInt();
+	settings.commands = parser.value(length).toLongLong();
+	settings.moveWeight = parser.value(move).toInt();
+	settings.mixWeight = parser.value(mix).toInt();
+	settings.splitWeight = parser.value(split).toInt();
+	settings.mixSteps = parser.value(mixSteps).toInt();
+	settings.lifetime = parser.value(lifetime).toInt();
+	settings.seed = parser.value(seed).toULongLong();
+
+	QTextStream err(stderr);
+	ProtocolGenerator generator(settings);
+	QString message;
+	QFile file(files[0]);
+	if (!file.open(QFile::WriteOnly | QFile::Text)) {
+		err << "Cannot write " << files[0] << ".\n";
+		return 1;
+	}
+	QTextStream out(&file);
+	if (!generator.generate(out, message) || !saveChipConfig(files[1], generator.chip(), message)) {
+		err << message << "\n";
+		return 1;
+	}
+
+	ChipConfig config = generator.chip();
+	err << generator.commandCount() << " commands, " << generator.makespan() << " seconds, on a " << config.rows << " x " << config.columns << " chip.\n";
+	return 0;
+}
@@ -0,0 +1,164 @@
+#include "generator.h"
+
+GeneratorSettings::GeneratorSettings() : rows(12), droplets(3), commands(1000), moveWeight(6), mixWeight(2), splitWeight(1), mixSteps(8), lifetime(20), seed(0) {}
+
+ProtocolGenerator::ProtocolGenerator(const GeneratorSettings &settings) : settings(settings), random(settings.seed), count(0), finish(0) {}
+
+ChipConfig ProtocolGenerator::chip() const {
+	ChipConfig config;
+	config.init(settings.rows, settings.droplets * 4 - 1);
+	if (!config.valid) return config;
+
+	for (qint32 i = 0; i < settings.droplets; ++i) {
+		config.T[i * 4 + 1] = PortType::input;
+		config.B[i * 4 + 1] = PortType::output;
+	}
+	config.L[config.rows / 2] = PortType::wash;
+	config.R[config.rows / 2] = PortType::waste;
+	config.hasWash = true;
+	return config;
+}
+
+bool ProtocolGenerator::generate(QTextStream &out, QString &message) {
+	if (settings.droplets < 1 || !chip().valid) {
+		message = QString("%1 droplet(s) on %2 rows do not fit on a chip: it has 3 to %3 rows and columns, and each droplet takes 4 columns but the last.").arg(settings.droplets).arg(settings.rows).arg(maxChipSize);
+		return false;
+	}
+	if (settings.moveWeight < 0 || settings.mixWeight < 0 || settings.splitWeight < 0 || settings.moveWeight + settings.mixWeight + settings.splitWeight <= 0) {
+		message = QString("The weights of the operations must not be negative, and at least one must be positive.");
+		return false;
+	}
+	if (settings.mixSteps < 1 || settings.lifetime < 1) {
+		message = QString("A Mix takes at least one step, and a droplet at least one operation.");
+		return false;
+	}
+
+	random = Random(settings.seed);
+	count = 0;
+	finish = 0;
+
+	// Lanes take turns second by second, so the commands come out in the order of time
+	QVector<Lane> lanes(settings.droplets, Lane({Empty, false, 0, 0, 0}));
+	for (qint32 t = 0; ; ++t) {
+		bool draining = count >= settings.commands, busy = false;
+		for (qint32 i = 0; i < lanes.size(); ++i) {
+			Lane &lane = lanes[i];
+			if (lane.state == Empty && draining) continue;
+			busy = true;
+			if (lane.ready == t) {
+				step(lane, i * 4, t, draining, out);
+				finish = std::max(finish, lane.ready);
+			}
+		}
+		if (!busy) break;
+	}
+
+	if (out.status() != QTextStream::Ok) {
+		message = QString("Cannot write the commands.");
+		return false;
+	}
+	return true;
+}
+
+qint64 ProtocolGenerator::commandCount() const {
+	return count;
+}
+
+qint32 ProtocolGenerator::makespan() const {
+	return finish;
+}
+
+void ProtocolGenerator::step(Lane &lane, qint32 left, qint32 t, bool draining, QTextStream &out) {
+	qint32 middle = left + 1, bottom = settings.rows - 1;
+
+	if (lane.state == Empty) {
+		write(out, "Input", t, QVector<Position>({Position(middle, 0)}));
+		lane = Lane({Single, false, middle, 0, t + 1});
+		return;
+	}
+	if (draining || (lane.state == Single && random.randInt(1, settings.lifetime) == 1)) {
+		lane.leaving = true;
+	}
+
+	if (lane.state == Pair) {
+		// The halves move up or down side by side, then merge again
+		if (!lane.leaving && random.randInt(0, 1) == 0) {
+			qint32 dy = random.randInt(0, 1) ? 1 : -1;
+			if (lane.y + dy < 0 || lane.y + dy > bottom) {
+				dy = -dy;
+			}
+			write(out, "Move", t, QVector<Position>({Position(left, lane.y), Position(left, lane.y + dy)}));
+			write(out, "Move", t, QVector<Position>({Position(left + 2, lane.y), Position(left + 2, lane.y + dy)}));
+			lane.y += dy;
+			lane.ready = t + 1;
+		} else {
+			write(out, "Merge", t, QVector<Position>({Position(left, lane.y), Position(left + 2, lane.y)}));
+			lane.state = Single;
+			lane.ready = t + 2;
+		}
+		return;
+	}
+
+	auto moveTo = [&](qint32 x, qint32 y) {
+		write(out, "Move", t, QVector<Position>({Position(lane.x, lane.y), Position(x, y)}));
+		lane.x = x;
+		lane.y = y;
+		lane.ready = t + 1;
+	};
+
+	if (lane.leaving) {
+		if (lane.x != middle) {
+			moveTo(middle, lane.y);
+		} else if (lane.y != bottom) {
+			moveTo(middle, lane.y + 1);
+		} else {
+			write(out, "Output", t, QVector<Position>({Position(middle, bottom)}));
+			lane = Lane({Empty, false, 0, 0, t + 1});
+		}
+		return;
+	}
+
+	qint32 r = random.randInt(1, settings.moveWeight + settings.mixWeight + settings.splitWeight);
+	if (r <= settings.mixWeight) {
+		// Round a 2 x 2 square inside the lane
+		qint32 dx = lane.x < left + 2 ? 1 : -1, dy = lane.y < bottom ? 1 : -1;
+		const qint32 loopX[4] = {0, dx, dx, 0}, loopY[4] = {0, 0, dy, dy};
+		qint32 steps = random.randInt(1, settings.mixSteps);
+		QVector<Position> cells;
+		for (qint32 k = 0; k <= steps; ++k) {
+			cells.push_back(Position(lane.x + loopX[k % 4], lane.y + loopY[k % 4]));
+		}
+		write(out, "Mix", t, cells);
+		lane.x = cells.back().first;
+		lane.y = cells.back().second;
+		lane.ready = t + steps;
+	} else if (r <= settings.mixWeight + settings.splitWeight) {
+		// A Split needs the whole width of the lane
+		if (lane.x != middle) {
+			moveTo(middle, lane.y);
+		} else {
+			write(out, "Split", t, QVector<Position>({Position(middle, lane.y), Position(left, lane.y), Position(left + 2, lane.y)}));
+			lane.state = Pair;
+			lane.ready = t + 2;
+		}
+	} else {
+		QVector<Position> moves;
+		for (qint32 k = 0; k < 4; ++k) {
+			qint32 x = lane.x + dirX[k], y = lane.y + dirY[k];
+			if (x >= left && x <= left + 2 && y >= 0 && y <= bottom) {
+				moves.push_back(Position(x, y));
+			}
+		}
+		Position p = moves[random.randInt(0, moves.size() - 1)];
+		moveTo(p.first, p.second);
+	}
+}
+
+void ProtocolGenerator::write(QTextStream &out, const char *name, qint32 t, const QVector<Position> &cells) {
+	out << name << ' ' << t;
+	for (const Position &p : cells) {
+		out << ',' << p.first + 1 << ',' << settings.rows - p.second;
+	}
+	out << ";\n";
+	++count;
+}
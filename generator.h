@@ -0,0 +1,58 @@
+#ifndef GENERATOR_H
+#define GENERATOR_H
+
+#include <QVector>
+#include <QTextStream>
+
+#include "utility.h"
+
+// Generates long valid protocols for scaling tests. Every concurrent droplet works in a lane of three columns,
+// with an empty column between lanes, so droplets of different lanes always keep their distance. A droplet is
+// dispensed from the input port above the middle of its lane, takes random Move, Mix and Split operations, where
+// the two halves of a Split move side by side and are merged again, and leaves through the output port below.
+// Commands are written in the order of time while they are generated, so the memory does not grow with the length.
+
+struct GeneratorSettings {
+	qint32 rows;
+	qint32 droplets; // concurrent droplets, one per lane
+	qint64 commands; // protocol length; droplets on the chip are still taken to the output when it is reached
+	qint32 moveWeight, mixWeight, splitWeight; // relative frequencies of the operations
+	qint32 mixSteps; // longest Mix
+	qint32 lifetime; // mean number of operations of a droplet before it leaves
+	quint64 seed;
+	GeneratorSettings();
+};
+
+class ProtocolGenerator {
+public:
+	explicit ProtocolGenerator(const GeneratorSettings &settings);
+
+	ChipConfig chip() const; // lanes side by side, with a wash port on the left and a waste port on the right
+
+	bool generate(QTextStream &out, QString &message);
+
+	qint64 commandCount() const;
+	qint32 makespan() const;
+
+private:
+	enum LaneState {
+		Empty, Single, Pair
+	};
+
+	struct Lane {
+		LaneState state;
+		bool leaving; // the droplet is on its way to the output port
+		qint32 x, y; // droplet, or the middle between the halves of a Split
+		qint32 ready; // second of the next command
+	};
+
+	void step(Lane &lane, qint32 left, qint32 t, bool draining, QTextStream &out);
+	void write(QTextStream &out, const char *name, qint32 t, const QVector<Position> &cells);
+
+	GeneratorSettings settings;
+	Random random;
+	qint64 count;
+	qint32 finish;
+};
+
+#endif // GENERATOR_H
@@ -0,0 +1,167 @@
+#include "liveinput.h"
+
+#include <QFile>
+#include <QElapsedTimer>
+
+#ifdef Q_OS_UNIX
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#endif
+
+LiveInput::LiveInput(const ChipConfig &config, quint64 seed, bool recover, QVector<Droplet> *droplets, Timeline *timeline, QObject *parent) :
+	QObject(parent), expander(QString()), droplets(droplets), timeline(timeline), line(0), busy(0), peak(0), fd(-1), notifier(nullptr), socket(nullptr), reading(false) {
+	loader.startLive(config, seed, recover);
+}
+
+LiveInput::~LiveInput() {
+	close();
+}
+
+bool LiveInput::open(const QString &source, bool socket, QString &message) {
+	if (socket) {
+		this->socket = new QLocalSocket(this);
+		this->socket->connectToServer(source);
+		if (!this->socket->waitForConnected(3000)) {
+			message = QString("Cannot connect to %1: %2").arg(source, this->socket->errorString());
+			return false;
+		}
+		connect(this->socket, SIGNAL(readyRead()), this, SLOT(onSocketReadyRead()));
+		connect(this->socket, SIGNAL(disconnected()), this, SLOT(onSocketDisconnected()));
+		reading = true;
+		return true;
+	}
+
+#ifdef Q_OS_UNIX
+	// A named pipe opened without blocking waits for its writer instead of the window
+	fd = source == "-" ? STDIN_FILENO : ::open(QFile::encodeName(source).constData(), O_RDONLY | O_NONBLOCK);
+	if (fd < 0) {
+		message = QString("Cannot open %1: %2").arg(source, QString::fromLocal8Bit(strerror(errno)));
+		return false;
+	}
+	notifier = new QSocketNotifier(fd, QSocketNotifier::Read, this);
+	connect(notifier, SIGNAL(activated(int)), this, SLOT(onReadable()));
+	reading = true;
+	return true;
+#else
+	message = QString("Cannot read %1: stdin and named pipes are only read on Unix systems, use a local socket.").arg(source);
+	return false;
+#endif
+}
+
+void LiveInput::close() {
+	reading = false;
+	if (notifier != nullptr) {
+		notifier->setEnabled(false);
+	}
+	if (socket != nullptr) {
+		socket->disconnect(this);
+		socket->abort();
+	}
+#ifdef Q_OS_UNIX
+	if (fd > STDIN_FILENO) {
+		::close(fd);
+	}
+#endif
+	fd = -1;
+}
+
+bool LiveInput::isOpen() const {
+	return reading;
+}
+
+qint32 LiveInput::liveTime() const {
+	return loader.liveTime();
+}
+
+void LiveInput::result(qint64 &minTime, qint64 &maxTime, ErrorLog &error, ErrorList &errors) const {
+	loader.liveResult(minTime, maxTime, error, errors);
+}
+
+qint32 LiveInput::commands() const {
+	return line;
+}
+
+qreal LiveInput::meanLatency() const {
+	return line > 0 ? busy / 1000.0 / line : 0;
+}
+
+qreal LiveInput::peakLatency() const {
+	return peak / 1000.0;
+}
+
+void LiveInput::onReadable() {
+	if (!reading) return;
+#ifdef Q_OS_UNIX
+	char buffer[65536];
+	ssize_t n = ::read(fd, buffer, sizeof(buffer));
+	if (n > 0) {
+		process(QByteArray(buffer, qint32(n)), false);
+	} else if (n == 0) {
+		end(QString());
+	} else if (errno != EAGAIN && errno != EINTR) {
+		end(QString::fromLocal8Bit(strerror(errno)));
+	}
+#endif
+}
+
+void LiveInput::onSocketReadyRead() {
+	if (!reading) return;
+	process(socket->readAll(), false);
+}
+
+void LiveInput::onSocketDisconnected() {
+	if (!reading) return;
+	end(socket->error() == QLocalSocket::PeerClosedError ? QString() : socket->errorString());
+}
+
+void LiveInput::process(const QByteArray &data, bool last) {
+	pending.append(data);
+	if (last && !pending.isEmpty() && !pending.endsWith('\n')) {
+		pending.append('\n');
+	}
+
+	// The loader works on the droplets and the timeline of the caller while the lines are taken
+	QStringList refusals;
+	auto append = [this, &refusals](const CommandRecord &record, QString &) -> bool {
+		QString message;
+		if (!loader.append(record, message)) {
+			refusals.push_back(message);
+		}
+		return true;
+	};
+	loader.exchange(*droplets, *timeline);
+	QElapsedTimer timer;
+	qint32 begin = 0;
+	for (qint32 next; (next = pending.indexOf('\n', begin)) >= 0; begin = next + 1) {
+		timer.start();
+		QString message;
+		if (!expander.feed(QString::fromUtf8(pending.constData() + begin, next - begin), line++, append, message)) {
+			refusals.push_back(message);
+		}
+		qint64 elapsed = timer.nsecsElapsed();
+		busy += elapsed;
+		peak = std::max(peak, elapsed);
+	}
+	if (last) {
+		QString message;
+		if (!expander.finish(message)) {
+			refusals.push_back(message);
+		}
+		loader.endLive();
+	}
+	loader.exchange(*droplets, *timeline);
+	pending.remove(0, begin);
+
+	for (const QString &message : refusals) {
+		emit refused(message);
+	}
+	emit updated();
+}
+
+void LiveInput::end(const QString &message) {
+	process(QByteArray(), true);
+	close();
+	emit finished(message);
+}
@@ -0,0 +1,60 @@
+#ifndef LIVEINPUT_H
+#define LIVEINPUT_H
+
+#include <QObject>
+#include <QByteArray>
+#include <QStringList>
+#include <QLocalSocket>
+#include <QSocketNotifier>
+
+#include "utility.h"
+
+// Commands read while a controller writes them, from stdin ("-"), a named pipe or a local socket. They come in the
+// order of time, from second 0 on, and each is checked against the chip as it is when the command comes: the droplets
+// and the timeline given grow in place, so a command costs the same however long the session has run.
+class LiveInput : public QObject {
+	Q_OBJECT
+
+public:
+	// The droplets and the timeline belong to the caller, who reads them between the signals
+	LiveInput(const ChipConfig &config, quint64 seed, bool recover, QVector<Droplet> *droplets, Timeline *timeline, QObject *parent = nullptr);
+	~LiveInput();
+
+	bool open(const QString &source, bool socket, QString &message); // stdin and named pipes need a Unix system
+	void close(); // stops reading, without a signal
+	bool isOpen() const;
+
+	qint32 liveTime() const; // the protocol only changes from this second on
+	void result(qint64 &minTime, qint64 &maxTime, ErrorLog &error, ErrorList &errors) const; // adds the errors after those in errors
+	qint32 commands() const; // lines read
+	qreal meanLatency() const; // time taken by a line, in microseconds
+	qreal peakLatency() const;
+
+signals:
+	void updated(); // commands were added
+	void refused(const QString &message); // a line that could not be taken, which is not an error of the protocol
+	void finished(const QString &message); // the input ended; the message tells why if it broke
+
+private slots:
+	void onReadable();
+	void onSocketReadyRead();
+	void onSocketDisconnected();
+
+private:
+	void process(const QByteArray &data, bool last);
+	void end(const QString &message);
+
+	ProtocolLoader loader;
+	CommandExpander expander;
+	QVector<Droplet> *droplets;
+	Timeline *timeline;
+	QByteArray pending; // the line being written
+	qint32 line;
+	qint64 busy, peak; // in nanoseconds
+	int fd; // stdin or the named pipe, -1 if none
+	QSocketNotifier *notifier;
+	QLocalSocket *socket;
+	bool reading;
+};
+
+#endif // LIVEINPUT_H
@@ -0,0 +1,69 @@
+#include "loadworker.h"
+
+#include <QElapsedTimer>
+
+const qint64 progressPeriod = 50; // shortest time between two progress signals, in milliseconds
+
+LoadWorker::LoadWorker(QObject *parent) : QObject(parent), wanted(-1) {
+	qRegisterMetaType<ChipConfig>();
+	qRegisterMetaType<QSharedPointer<LoadedProtocol>>();
+}
+
+void LoadWorker::request(qint32 id, const QString &url, const ChipConfig &config, quint64 seed, bool recover) {
+	wanted.storeRelease(id);
+	QMetaObject::invokeMethod(this, "load", Qt::QueuedConnection, Q_ARG(qint32, id), Q_ARG(QString, url), Q_ARG(ChipConfig, config), Q_ARG(quint64, seed), Q_ARG(bool, recover));
+}
+
+void LoadWorker::requestReload(qint32 id, const ProtocolLoader &loader, const ChipConfig &config) {
+	// The loader on display stays as it is until the reload is taken over, or if it is stopped
+	QSharedPointer<LoadedProtocol> protocol(new LoadedProtocol);
+	protocol->loader = loader;
+	wanted.storeRelease(id);
+	QMetaObject::invokeMethod(this, "reload", Qt::QueuedConnection, Q_ARG(qint32, id), Q_ARG(QSharedPointer<LoadedProtocol>, protocol), Q_ARG(ChipConfig, config));
+}
+
+void LoadWorker::cancel() {
+	wanted.storeRelease(-1);
+}
+
+ProtocolLoader::Progress LoadWorker::reporter(qint32 id) {
+	QElapsedTimer timer;
+	timer.start();
+	qint64 last = -progressPeriod;
+	return [this, id, timer, last](qint64 bytes, qint64 totalBytes, qint32 commands, qint32 totalCommands) mutable -> bool {
+		if (wanted.loadAcquire() != id) return false;
+		if (timer.elapsed() - last >= progressPeriod) {
+			last = timer.elapsed();
+			emit progress(id, bytes, totalBytes, commands, totalCommands);
+		}
+		return true;
+	};
+}
+
+void LoadWorker::load(qint32 id, const QString &url, const ChipConfig &config, quint64 seed, bool recover) {
+	QSharedPointer<LoadedProtocol> protocol(new LoadedProtocol);
+	protocol->url = url;
+	protocol->seed = seed;
+
+	if (wanted.loadAcquire() != id || !protocol->loader.load(url, config, seed, recover, reporter(id))) {
+		emit loaded(id, QSharedPointer<LoadedProtocol>());
+		return;
+	}
+	protocol->loader.result(protocol->droplets, protocol->minTime, protocol->maxTime, protocol->timeline, protocol->error, &protocol->errors);
+	protocol->occupancyIndex.build(config, protocol->droplets);
+	emit loaded(id, protocol);
+}
+
+void LoadWorker::reload(qint32 id, QSharedPointer<LoadedProtocol> protocol, const ChipConfig &config) {
+	protocol->reloaded = true;
+	protocol->changed = wanted.loadAcquire() == id && protocol->loader.reload(reporter(id));
+	if (wanted.loadAcquire() != id) {
+		emit loaded(id, QSharedPointer<LoadedProtocol>());
+		return;
+	}
+	if (protocol->changed) {
+		protocol->loader.result(protocol->droplets, protocol->minTime, protocol->maxTime, protocol->timeline, protocol->error, &protocol->errors);
+		protocol->occupancyIndex.build(config, protocol->droplets);
+	}
+	emit loaded(id, protocol);
+}
@@ -0,0 +1,56 @@
+#ifndef LOADWORKER_H
+#define LOADWORKER_H
+
+#include <QObject>
+#include <QAtomicInt>
+#include <QSharedPointer>
+
+#include "utility.h"
+
+// Everything the main window takes over from a finished load, built on the worker thread
+struct LoadedProtocol {
+	ProtocolLoader loader; // for the reloads after the file changes
+	QString url;
+	quint64 seed;
+	bool reloaded; // by a reload, which keeps the moment on display
+	bool changed; // false if a reload found the same commands, and only the loader is filled in
+	QVector<Droplet> droplets;
+	qint64 minTime, maxTime;
+	Timeline timeline;
+	ErrorLog error;
+	ErrorList errors;
+	OccupancyIndex occupancyIndex;
+	LoadedProtocol() : seed(0), reloaded(false), changed(true), minTime(0), maxTime(0), error(-2, "") {}
+};
+
+Q_DECLARE_METATYPE(ChipConfig)
+Q_DECLARE_METATYPE(QSharedPointer<LoadedProtocol>)
+
+// Parses and simulates command files on a thread of their own, so that the window keeps running the protocol it has.
+// Only the last load requested is wanted: the ones before it, and a cancelled one, stop at their next progress report.
+class LoadWorker : public QObject {
+	Q_OBJECT
+
+public:
+	explicit LoadWorker(QObject *parent = nullptr);
+
+	// Called on the thread of the window; the id tells the signals of this load from those of earlier ones
+	void request(qint32 id, const QString &url, const ChipConfig &config, quint64 seed, bool recover);
+	void requestReload(qint32 id, const ProtocolLoader &loader, const ChipConfig &config); // works on a copy of the loader
+	void cancel();
+
+signals:
+	void progress(qint32 id, qint64 bytes, qint64 totalBytes, qint32 commands, qint32 totalCommands);
+	void loaded(qint32 id, QSharedPointer<LoadedProtocol> protocol); // null if the load stopped
+
+private slots:
+	void load(qint32 id, const QString &url, const ChipConfig &config, quint64 seed, bool recover);
+	void reload(qint32 id, QSharedPointer<LoadedProtocol> protocol, const ChipConfig &config);
+
+private:
+	ProtocolLoader::Progress reporter(qint32 id);
+
+	QAtomicInt wanted; // id of the load still wanted, -1 if none
+};
+
+#endif // LOADWORKER_H
@@ -1,13 +1,182 @@
+#include <QTextStream>
 #include <QApplication>
+#include <QElapsedTimer>
+#include <QScopedPointer>
+#include <QCommandLineParser>
 
 #include "mainwindow.h"
+#include "liveinput.h"
+
+// Starts the simulator, or checks a protocol without a window:
+//   dmfb [--chip <chip file>] [--autoplay] [--speed <factor>] [--all-errors] [--seed <n>] [--contamination-weight <seconds>] [command file]
+//   dmfb --headless --chip <chip file> [--all-errors] [--seed <n>] <command file>
+//   dmfb [--headless] --chip <chip file> [--all-errors] [--seed <n>] (--live <- or named pipe> | --live-socket <name>)
+
+// Loads the protocol and replays its contamination, then prints the timings and the errors
+int runHeadless(const QString &chipUrl, const QString &url, bool allErrors, quint64 seed) {
+	QTextStream out(stdout), err(stderr);
+	ChipConfig config;
+	QString message;
+	if (!loadChipConfig(chipUrl, config, message)) {
+		err << message << "\n";
+		return 2;
+	}
+
+	QElapsedTimer timer;
+	timer.start();
+	ProtocolLoader loader;
+	loader.load(url, config, seed, allErrors);
+	QVector<Droplet> droplets;
+	qint64 minTime, maxTime;
+	Timeline timeline;
+	ErrorLog error(-2, "");
+	ErrorList errors;
+	loader.result(droplets, minTime, maxTime, timeline, error, &errors);
+	qint64 loadTime = timer.elapsed();
+
+	timer.restart();
+	maxTime = std::max((maxTime / 1000) * 1000, minTime); // a protocol without commands, or that cannot be read, takes no time
+	ContaminationMap contamination;
+	ContaminationSummary summary;
+	fastForward(config, timeline, maxTime, contamination, summary);
+	qint64 replayTime = timer.elapsed();
+
+	out << "droplets " << droplets.size() << ", seconds " << maxTime / 1000 << ", events " << timeline.size() << ", seed " << seed << "\n";
+	out << "load " << loadTime << " ms, replay " << replayTime << " ms\n";
+	out << "contaminated cells " << summary.cells << ", residues " << summary.residues << "\n";
+	if (errors.empty() && error.t >= 0) {
+		errors.push_back(error);
+	}
+	for (const ErrorLog &e : errors) {
+		err << e.msg << "\n";
+	}
+	return errors.empty() ? 0 : 1;
+}
+
+// Reads the commands as they come and prints the errors at once, then the timings when the input ends
+int runLive(const QString &chipUrl, const QString &source, bool socket, bool allErrors, quint64 seed) {
+	QTextStream out(stdout), err(stderr);
+	ChipConfig config;
+	QString message;
+	if (!loadChipConfig(chipUrl, config, message)) {
+		err << message << "\n";
+		return 2;
+	}
+
+	QVector<Droplet> droplets;
+	Timeline timeline;
+	LiveInput input(config, seed, allErrors, &droplets, &timeline);
+	if (!input.open(source, socket, message)) {
+		err << message << "\n";
+		return 2;
+	}
+
+	qint64 minTime = 0, maxTime = 0;
+	ErrorLog error(-2, "");
+	ErrorList errors;
+	bool failed = false;
+	QObject::connect(&input, &LiveInput::updated, [&]() {
+		qint32 shown = errors.size();
+		input.result(minTime, maxTime, error, errors);
+		for (qint32 i = shown; i < errors.size(); ++i) {
+			err << errors[i].msg << "\n";
+		}
+		if (errors.empty() && error.t >= 0 && !failed) {
+			err << error.msg << "\n";
+		}
+		failed = failed || error.t >= 0 || !errors.empty();
+		err.flush();
+	});
+	QObject::connect(&input, &LiveInput::refused, [&](const QString &message) {
+		err << message << "\n";
+		err.flush();
+		failed = true;
+	});
+	QObject::connect(&input, &LiveInput::finished, [&](const QString &message) {
+		if (!message.isEmpty()) {
+			err << message << "\n";
+		}
+		QCoreApplication::exit(message.isEmpty() ? 0 : 2);
+	});
+	int code = QCoreApplication::exec();
+
+	maxTime = (maxTime / 1000) * 1000;
+	ContaminationMap contamination;
+	ContaminationSummary summary;
+	fastForward(config, timeline, maxTime, contamination, summary);
+
+	out << "droplets " << droplets.size() << ", seconds " << maxTime / 1000 << ", events " << timeline.size() << ", seed " << seed << "\n";
+	out << "lines " << input.commands() << ", " << input.meanLatency() << " us per line, " << input.peakLatency() << " us at most\n";
+	out << "contaminated cells " << summary.cells << ", residues " << summary.residues << "\n";
+	return code != 0 ? code : failed ? 1 : 0;
+}
 
 int main(int argc, char *argv[]) {
-	QApplication::setAttribute(Qt::AA_EnableHighDpiScaling);
-	QApplication::setAttribute(Qt::AA_UseHighDpiPixmaps);
-	QApplication app(argc, argv);
+	// Without a window, no display is needed
+	bool headless = false;
+	for (qint32 i = 1; i < argc; ++i) {
+		if (QString(argv[i]) == "--headless") {
+			headless = true;
+		}
+	}
+	if (!headless) {
+		QApplication::setAttribute(Qt::AA_EnableHighDpiScaling);
+		QApplication::setAttribute(Qt::AA_UseHighDpiPixmaps);
+	}
+	QScopedPointer<QCoreApplication> app(headless ? new QCoreApplication(argc, argv) : new QApplication(argc, argv));
+	QCoreApplication::setApplicationName("dmfb");
+
+	QCommandLineParser parser;
+	parser.setApplicationDescription("Digital microfluidic biochip simulator.");
+	parser.addHelpOption();
+	parser.addPositionalArgument("commands", "Command file to load.", "[commands]");
+	QCommandLineOption chip("chip", "Chip file to open.", "file");
+	QCommandLineOption autoplay("autoplay", "Start the run once the command file is loaded.");
+	QCommandLineOption speed("speed", "Simulated seconds per second of the run.", "factor", QString::number(runAcceleration));
+	QCommandLineOption allErrors("all-errors", "Go on after an error and report every one (File - Report All Errors).");
+	QCommandLineOption headlessOption("headless", "Load the command file without a window, print the timings and the errors, and exit with 1 if there are errors.");
+	QCommandLineOption live("live", "Run the commands as they are written to the source: - for stdin, or a named pipe.", "source");
+	QCommandLineOption liveSocket("live-socket", "Run the commands as they are written to the local socket.", "name");
+	QCommandLineOption seedOption("seed", "Seed of the droplet colours, the wash colour and the contamination dots (File - Random Seed), 0 without a window; a new one every load by default.", "n");
+	QCommandLineOption contaminationWeight("contamination-weight", "Seconds a routed path may spend to avoid entering a stained cell (File - Route Assay).", "seconds", "1");
+	parser.addOptions({chip, autoplay, speed, allErrors, headlessOption, live, liveSocket, seedOption, contaminationWeight});
+	parser.process(*app);
+
+	QStringList files = parser.positionalArguments();
+	bool ok = false;
+	qreal factor = parser.value(speed).toDouble(&ok);
+	bool okWeight = false;
+	qint32 weight = parser.value(contaminationWeight).toInt(&okWeight);
+	bool okSeed = !parser.isSet(seedOption);
+	quint64 seed = okSeed ? 0 : parser.value(seedOption).toULongLong(&okSeed);
+	bool liveSet = parser.isSet(live) || parser.isSet(liveSocket);
+	if (files.size() > 1 || !ok || factor <= 0 || !okWeight || weight < 0 || !okSeed || (!files.empty() && !parser.isSet(chip)) || (headless && files.empty() && !liveSet)
+			|| (liveSet && (!files.empty() || !parser.isSet(chip) || (parser.isSet(live) && parser.isSet(liveSocket))))) {
+		parser.showHelp(2);
+	}
+	QString source = parser.isSet(live) ? parser.value(live) : parser.value(liveSocket);
+
+	if (headless && liveSet) {
+		return runLive(parser.value(chip), source, parser.isSet(liveSocket), parser.isSet(allErrors), seed);
+	}
+	if (headless) {
+		return runHeadless(parser.value(chip), files[0], parser.isSet(allErrors), seed);
+	}
 
 	MainWindow wnd;
+	wnd.setRunSpeed(factor);
+	wnd.setReportAllErrors(parser.isSet(allErrors));
+	wnd.setContaminationWeight(weight);
+	if (parser.isSet(seedOption)) {
+		wnd.setSeed(seed);
+	}
 	wnd.show();
-	return app.exec();
+	if (parser.isSet(chip) && wnd.openChip(parser.value(chip))) {
+		if (liveSet) {
+			wnd.startLive(source, parser.isSet(liveSocket));
+		} else if (!files.empty()) {
+			wnd.openCommandFile(files[0], parser.isSet(autoplay));
+		}
+	}
+	return app->exec();
 }
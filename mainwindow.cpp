@@ -4,14 +4,14 @@
 
 #include <QFile>
 #include <QDebug>
-#include <QStack>
-#include <QQueue>
 #include <QMimeData>
 #include <QDropEvent>
 #include <QTextStream>
 #include <QMessageBox>
 #include <QFileDialog>
+#include <QInputDialog>
 #include <QDragEnterEvent>
+#include <QFileInfo>
 
 #include "dlgabout.h"
 #include "dlgnewchip.h"
@@ -20,14 +20,17 @@
 #include "ui_mainwindow.h"
 
 #include "ui.h"
+#include "router.h"
+#include "compactor.h"
 #include "utility.h"
 
 MainWindow::MainWindow(QWidget *parent) :
 	QMainWindow(parent), ui(new Ui::MainWindow),
 	dataLoaded(false),
-	sndMove("qrc:/sounds/move.wav"), sndMerge("qrc:/sounds/merge.wav"), sndSplitting("qrc:/sounds/splitting.wav"), sndSplit("qrc:/sounds/split.wav"), sndError("qrc:/sounds/error.wav"),
+	mixer(false, this),
 	error(-2, ""),
-	timerRun(this), timerWash(this) {
+	loadId(0), loading(false), reloading(false), autoplay(false), contaminationWeight(1),
+	timerReload(this), liveInput(nullptr), seedFixed(false), fixedSeed(0), timerRun(this), runSpeed(runAcceleration), timerWash(this), washDroplets(1) {
 	ui->setupUi(this);
 
 	timerRun.setInterval(25);
@@ -36,20 +39,38 @@ MainWindow::MainWindow(QWidget *parent) :
 	timerWash.setInterval(25);
 	connect(&timerWash, SIGNAL(timeout()), this, SLOT(onWashTimeout()));
 
+	loadWorker = new LoadWorker;
+	loadWorker->moveToThread(&loadThread);
+	connect(&loadThread, SIGNAL(finished()), loadWorker, SLOT(deleteLater()));
+	connect(loadWorker, SIGNAL(progress(qint32, qint64, qint64, qint32, qint32)), this, SLOT(onLoadProgress(qint32, qint64, qint64, qint32, qint32)));
+	connect(loadWorker, SIGNAL(loaded(qint32, QSharedPointer<LoadedProtocol>)), this, SLOT(onLoaded(qint32, QSharedPointer<LoadedProtocol>)));
+	loadThread.setObjectName("loader");
+	loadThread.start();
+
+	timerReload.setInterval(200);
+	timerReload.setSingleShot(true);
+	connect(&timerReload, SIGNAL(timeout()), this, SLOT(onReloadTimeout()));
+	connect(&watcher, SIGNAL(fileChanged(QString)), this, SLOT(onCommandFileChanged(QString)));
+
 	ui->picDisplay->installEventFilter(this);
 
 	ui->lblWashObstacleHints->setVisible(false);
+	ui->dockErrors->setVisible(false);
+	ui->widgetLoading->setVisible(false);
 
-	sndMove.setLoops(1);
-	sndMerge.setLoops(1);
-	sndSplit.setLoops(1);
-	sndSplitting.setLoops(1);
-	sndError.setLoops(1);
+	mixer.loadEffect(sndFxMove, ":/sounds/move.wav");
+	mixer.loadEffect(sndFxMerge, ":/sounds/merge.wav");
+	mixer.loadEffect(sndFxSplitting, ":/sounds/splitting.wav");
+	mixer.loadEffect(sndFxSplit, ":/sounds/split.wav");
+	mixer.loadEffect(sndFxError, ":/sounds/error.wav");
 
 	config.valid = false;
 }
 
 MainWindow::~MainWindow() {
+	loadWorker->cancel();
+	loadThread.quit();
+	loadThread.wait();
     delete ui;
 }
 
@@ -60,34 +81,123 @@ void MainWindow::on_actionNewChip_triggered() {
 }
 
 void MainWindow::onDlgNewChipAccepted(qint32 rows, qint32 columns) {
+	resetChip();
+
+	frmConfigChip *wndConfigChip = new frmConfigChip(this);
+	connect(wndConfigChip, SIGNAL(accepted(const ChipConfig &)), this, SLOT(onDlgConfigChipAccepted(const ChipConfig &)));
+	wndConfigChip->setDimensions(rows, columns);
+	wndConfigChip->show();
+}
+
+void MainWindow::onDlgConfigChipAccepted(const ChipConfig &config) {
+	applyChip(config);
+	selectFile();
+}
+
+void MainWindow::resetChip() {
 	ui->actionLoadCommandFile->setEnabled(false);
+	ui->actionRouteAssay->setEnabled(false);
+	ui->actionCompactCommandFile->setEnabled(false);
 	ui->actionStart->setEnabled(false);
 	ui->actionPause->setEnabled(false);
 	ui->actionStep->setEnabled(false);
+	ui->actionFastForward->setEnabled(false);
 	ui->actionRevert->setEnabled(false);
 	ui->actionReset->setEnabled(false);
 	ui->actionWash->setEnabled(false);
+	ui->actionSaveChip->setEnabled(false);
 	ui->lblWashObstacleHints->setVisible(false);
 
 	dataLoaded = false;
+	cancelLoading();
+	stopLive();
 
 	clearObstacles();
 	clearContaminants();
-
-	frmConfigChip *wndConfigChip = new frmConfigChip(this);
-	connect(wndConfigChip, SIGNAL(accepted(const ChipConfig &)), this, SLOT(onDlgConfigChipAccepted(const ChipConfig &)));
-	wndConfigChip->setDimensions(rows, columns);
-	wndConfigChip->show();
 }
 
-void MainWindow::onDlgConfigChipAccepted(const ChipConfig &config) {
+void MainWindow::applyChip(const ChipConfig &config) {
 	displayTime = 0;
 	this->config = config;
 	ui->actionLoadCommandFile->setEnabled(true);
+	ui->actionRouteAssay->setEnabled(true);
+	ui->actionCompactCommandFile->setEnabled(true);
+	ui->actionSaveChip->setEnabled(true);
 
 	clearObstacles();
 	clearContaminants();
-	selectFile();
+	render();
+}
+
+bool MainWindow::openChip(const QString &url) {
+	ChipConfig chip;
+	QString message;
+	if (!loadChipConfig(url, chip, message)) {
+		QMessageBox::warning(this, tr("Warning"), message);
+		return false;
+	}
+	resetChip();
+	applyChip(chip);
+	return true;
+}
+
+void MainWindow::openCommandFile(const QString &url, bool autoplay) {
+	if (!config.valid) return;
+	this->autoplay = autoplay;
+	loadFile(url);
+}
+
+void MainWindow::setRunSpeed(qreal speed) {
+	runSpeed = speed;
+}
+
+void MainWindow::setReportAllErrors(bool on) {
+	ui->actionReportAllErrors->setChecked(on);
+}
+
+void MainWindow::setContaminationWeight(qint32 weight) {
+	contaminationWeight = weight;
+}
+
+void MainWindow::setSeed(quint64 seed) {
+	seedFixed = true;
+	fixedSeed = seed;
+}
+
+quint64 MainWindow::nextSeed() const {
+	return seedFixed ? fixedSeed : Random::mix(quint64(QDateTime::currentMSecsSinceEpoch()));
+}
+
+void MainWindow::on_actionRandomSeed_triggered() {
+	// Empty for a new seed on every load; the seed in use is in the window title
+	bool ok = false;
+	QString text = QInputDialog::getText(this, tr("Random Seed"), tr("Seed of the next loads and live runs, empty for a new one each time:"), QLineEdit::Normal, seedFixed ? QString::number(fixedSeed) : QString(), &ok).trimmed();
+	if (!ok) return;
+	if (text.isEmpty()) {
+		seedFixed = false;
+		return;
+	}
+	quint64 seed = text.toULongLong(&ok);
+	if (!ok) {
+		QMessageBox::warning(this, tr("Warning"), tr("%1 is not a seed, which is a number from 0 to %2.").arg(text).arg(std::numeric_limits<quint64>::max()));
+		return;
+	}
+	setSeed(seed);
+}
+
+void MainWindow::on_actionOpenChip_triggered() {
+	QString url = QFileDialog::getOpenFileName(this, tr("Open Chip File"), ".", "Chip Files (*.chip);;All Files (*.*)");
+	if (url.isEmpty()) return;
+	openChip(url);
+}
+
+void MainWindow::on_actionSaveChip_triggered() {
+	QString url = QFileDialog::getSaveFileName(this, tr("Save Chip File"), ".", "Chip Files (*.chip);;All Files (*.*)");
+	if (url.isEmpty()) return;
+	QString message;
+	if (!saveChipConfig(url, config, message)) {
+		QMessageBox::warning(this, tr("Warning"), message);
+	}
 }
 
 void MainWindow::on_actionExit_triggered() {
@@ -103,6 +213,74 @@ void MainWindow::on_actionLoadCommandFile_triggered() {
 	selectFile();
 }
 
+void MainWindow::on_actionRouteAssay_triggered() {
+	QString url = QFileDialog::getOpenFileName(this, tr("Open Assay File"), ".", "All Files (*.*)");
+	if (url.isEmpty()) return;
+
+	QVector<AssayOperation> assay;
+	QString message;
+	if (!loadAssay(url, config, assay, message)) {
+		QMessageBox::warning(this, tr("Warning"), message);
+		return;
+	}
+
+	AssayRouter router(contaminationWeight);
+	QStringList commands;
+	if (!router.route(config, assay, commands, message)) {
+		QMessageBox::warning(this, tr("Warning"), message);
+		return;
+	}
+
+	if (!saveCommandFile(commands)) return;
+	QMessageBox::information(this, tr("Hint"), tr("%1 operation(s) routed in %2 ms, the protocol takes %3 seconds and enters %4 cell(s) stained by other droplets.").arg(assay.size()).arg(router.planningTime()).arg(router.makespan()).arg(router.crossings()));
+}
+
+void MainWindow::on_actionCompactCommandFile_triggered() {
+	QString url = QFileDialog::getOpenFileName(this, tr("Open Command File"), ".", "All Files (*.*)");
+	if (url.isEmpty()) return;
+
+	// Only a valid protocol can be compacted, its positions are kept as they are
+	QVector<Droplet> original;
+	qint64 originalMinTime, originalMaxTime;
+	Timeline originalTimeline;
+	ErrorLog originalError(-2, "");
+	::loadFile(url, config, original, originalMinTime, originalMaxTime, originalTimeline, originalError);
+	if (originalError.t >= 0) {
+		QMessageBox::warning(this, tr("Warning"), tr("The command file is invalid at moment %1, it cannot be compacted.").arg(originalError.t));
+		return;
+	}
+
+	CommandCompactor compactor;
+	QStringList commands;
+	QString message;
+	if (!compactor.compact(url, config, commands, message)) {
+		QMessageBox::warning(this, tr("Warning"), message);
+		return;
+	}
+
+	if (!saveCommandFile(commands)) return;
+	loadHint = tr("%1 command(s) moved earlier, the protocol takes %3 seconds instead of %2.").arg(compactor.shiftedCommands()).arg(originalMaxTime / 1000);
+}
+
+bool MainWindow::saveCommandFile(const QStringList &commands) {
+	QString target = QFileDialog::getSaveFileName(this, tr("Save Command File"), ".", "All Files (*.*)");
+	if (target.isEmpty()) return false;
+	QFile file(target);
+	if (!file.open(QFile::WriteOnly | QFile::Text)) {
+		QMessageBox::warning(this, tr("Warning"), tr("Cannot write %1.").arg(target));
+		return false;
+	}
+	QTextStream fs(&file);
+	for (qint32 i = 0; i < commands.size(); ++i) {
+		fs << commands[i] << "\n";
+	}
+	fs.flush();
+	file.close();
+
+	loadFile(target);
+	return true;
+}
+
 void MainWindow::selectFile() {
 	QFileDialog *fileDlg = new QFileDialog(this);
 	fileDlg->setWindowTitle(tr("Open Command File"));
@@ -129,30 +307,313 @@ void MainWindow::dropEvent(QDropEvent *e) {
 }
 
 void MainWindow::loadFile(const QString &url) {
-	::loadFile(url, config, droplets, minTime, maxTime, sounds, error, contaminants);
+	// The protocol on display keeps running until the new one is loaded; without recovery, it stops at the first error
+	stopLive();
+	++loadId;
+	loading = true;
+	reloading = false;
+	pendingProtocol.clear();
+	loadHint.clear();
+	loadWorker->request(loadId, url, config, nextSeed(), ui->actionReportAllErrors->isChecked());
+
+	ui->progressLoading->setValue(0);
+	ui->progressLoading->setFormat(tr("Loading %1...").arg(QFileInfo(url).fileName()));
+	ui->widgetLoading->setVisible(true);
+}
 
-	srand(quint32(QDateTime::currentMSecsSinceEpoch()));
+void MainWindow::onLoadProgress(qint32 id, qint64 bytes, qint64 totalBytes, qint32 commands, qint32 totalCommands) {
+	if (!loading || id != loadId) return;
 
-	randSeed = quint32(rand());
+	// Parsing takes the first half of the bar, checking the commands the second
+	qint32 value = totalBytes > 0 ? qint32(bytes * 500 / totalBytes) : 500;
+	if (totalCommands > 0) {
+		value += qint32(qint64(commands) * 500 / totalCommands);
+		ui->progressLoading->setFormat(tr("Checking command %1 of %2...").arg(commands).arg(totalCommands));
+	} else {
+		ui->progressLoading->setFormat(tr("Parsing %1 of %2 KB...").arg(bytes / 1024).arg(totalBytes / 1024));
+	}
+	ui->progressLoading->setValue(value);
+}
+
+void MainWindow::onLoaded(qint32 id, QSharedPointer<LoadedProtocol> protocol) {
+	if (!loading || id != loadId) return;
+	loading = reloading = false;
+	ui->widgetLoading->setVisible(false);
+	if (protocol.isNull()) return;
+
+	if (timerWash.isActive()) {
+		pendingProtocol = protocol;
+	} else {
+		applyProtocol(protocol);
+	}
+}
+
+void MainWindow::cancelLoading() {
+	loadWorker->cancel();
+	loading = reloading = false;
+	autoplay = false;
+	pendingProtocol.clear();
+	loadHint.clear();
+	ui->widgetLoading->setVisible(false);
+}
+
+void MainWindow::on_btnCancelLoading_clicked() {
+	cancelLoading();
+}
+
+void MainWindow::applyProtocol(const QSharedPointer<LoadedProtocol> &protocol) {
+	// A reload keeps the seed, the moment on display and the washes run by hand
+	loader = protocol->loader;
+	if (protocol->reloaded) {
+		watchFiles(); // the files included may be others now
+		if (!protocol->changed) return;
+	}
+	if (timerRun.isActive()) {
+		on_actionPause_triggered();
+	}
+
+	// Everything of the new protocol is taken over at once
+	if (!protocol->reloaded) {
+		randSeed = protocol->seed;
+		setWindowTitle(tr("DMFB Simulator (seed %1)").arg(randSeed));
+	}
+	droplets = protocol->droplets;
+	minTime = protocol->minTime;
+	maxTime = protocol->maxTime;
+	timeline = protocol->timeline;
+	error = protocol->error;
+	occupancyIndex = protocol->occupancyIndex;
+	showErrors(protocol->errors);
+
+	if (!protocol->reloaded) {
+		// Follow the changes of the files on disk
+		timerReload.stop();
+		commandFile = protocol->url;
+		watchFiles();
+
+		clearObstacles();
+		clearContaminants();
+
+		Random random(randSeed, streamWash);
+		washColor = QColor::fromHsv(random.randInt(0, 359), random.randInt(127, 255), random.randInt(127, 255), 0xff);
+	}
+
+	maxTime = std::max((maxTime / 1000) * 1000, minTime); // Truncate to seconds (in case any command failed), none if nothing ran
+	protocolMaxTime = maxTime;
+	washTrips.clear();
+
+	if (protocol->reloaded) {
+		// Only the seconds from the last checkpoint before the first changed command were simulated again. Stay at the
+		// same moment, with the contamination of the new protocol
+		addManualWashes(std::numeric_limits<qint64>::min());
+		displayTime = std::min(std::max(displayTime, minTime), maxTime);
+		replayTimeline();
+	} else {
+		manualWashes.clear();
+
+		ui->actionStart->setEnabled(true);
+		ui->actionStep->setEnabled(true);
+		ui->actionFastForward->setEnabled(true);
+
+		if (config.hasWash) {
+			ui->actionWash->setEnabled(true);
+		}
+
+		displayTime = minTime;
+		dataLoaded = true;
+		seekTimeline();
+	}
+
+	if (ui->actionWashOnline->isChecked()) {
+		scheduleOnlineWash();
+	}
+
+	this->update();
+
+	if (autoplay) {
+		autoplay = false;
+		on_actionStart_triggered();
+	}
+
+	if (!loadHint.isEmpty()) {
+		QMessageBox::information(this, tr("Hint"), loadHint.arg(maxTime / 1000));
+		loadHint.clear();
+	}
+}
+
+void MainWindow::showErrors(const ErrorList &errors) {
+	ui->listErrors->clear();
+	addErrors(errors, 0);
+}
+
+void MainWindow::addErrors(const ErrorList &errors, qint32 from) {
+	for (qint32 i = from; i < errors.size(); ++i) {
+		QListWidgetItem *item = new QListWidgetItem(errors[i].msg, ui->listErrors);
+		item->setData(Qt::UserRole, errors[i].t);
+	}
+	ui->dockErrors->setWindowTitle(tr("Errors (%1)").arg(ui->listErrors->count()));
+	ui->dockErrors->setVisible(ui->listErrors->count() > 0);
+}
+
+void MainWindow::on_listErrors_itemActivated(QListWidgetItem *item) {
+	if (!dataLoaded || timerWash.isActive()) return;
+	if (timerRun.isActive()) {
+		on_actionPause_triggered();
+	}
+
+	displayTime = std::min(std::max(item->data(Qt::UserRole).toInt() * qint64(1000), minTime), maxTime);
+	replayTimeline();
+
+	ui->actionRevert->setEnabled(true);
+	ui->actionReset->setEnabled(true);
+	render();
+}
+
+void MainWindow::onCommandFileChanged(const QString &url) {
+	// Editors that save by replacing the file take it off the watch list
+	if (!watcher.files().contains(url) && QFile::exists(url)) {
+		watcher.addPath(url);
+	}
+	timerReload.start();
+}
+
+void MainWindow::onReloadTimeout() {
+	// A load of another file in progress replaces the protocol anyway, a reload in progress is started again
+	if (!dataLoaded || (loading && !reloading) || !QFile::exists(commandFile)) return;
+	watchFiles();
+	if (timerWash.isActive()) {
+		// Try again after the wash
+		timerReload.start();
+		return;
+	}
+
+	// The protocol on display keeps running until the reload is done
+	++loadId;
+	loading = reloading = true;
+	loadWorker->requestReload(loadId, loader, config);
+
+	ui->progressLoading->setValue(0);
+	ui->progressLoading->setFormat(tr("Reloading %1...").arg(QFileInfo(commandFile).fileName()));
+	ui->widgetLoading->setVisible(true);
+}
+
+void MainWindow::watchFiles() {
+	// The command file and the files it includes; editors that save by replacing a file take it off the watch list
+	QStringList files = loader.files(), watched = watcher.files();
+	for (const QString &file : watched) {
+		if (!files.contains(file)) {
+			watcher.removePath(file);
+		}
+	}
+	for (const QString &file : files) {
+		if (!watched.contains(file) && QFile::exists(file)) {
+			watcher.addPath(file);
+		}
+	}
+}
+
+bool MainWindow::startLive(const QString &source, bool socket) {
+	if (!config.valid || timerWash.isActive()) return false;
+	cancelLoading();
+	stopLive();
+	if (timerRun.isActive()) {
+		on_actionPause_triggered();
+	}
+
+	quint64 seed = nextSeed();
+	LiveInput *input = new LiveInput(config, seed, ui->actionReportAllErrors->isChecked(), &droplets, &timeline, this);
+	QString message;
+	if (!input->open(source, socket, message)) {
+		delete input;
+		QMessageBox::warning(this, tr("Warning"), message);
+		return false;
+	}
+	liveInput = input;
+	connect(liveInput, SIGNAL(updated()), this, SLOT(onLiveUpdated()));
+	connect(liveInput, SIGNAL(refused(QString)), this, SLOT(onLiveRefused(QString)));
+	connect(liveInput, SIGNAL(finished(QString)), this, SLOT(onLiveFinished(QString)));
+
+	// The live protocol starts empty in place of the one on display, and follows no file
+	timerReload.stop();
+	loader = ProtocolLoader();
+	commandFile.clear();
+	watchFiles();
+
+	randSeed = seed;
+	setWindowTitle(tr("DMFB Simulator (seed %1)").arg(randSeed));
+	droplets.clear();
+	timeline.clear();
+	minTime = maxTime = protocolMaxTime = 0;
+	error = ErrorLog(-2, "");
+	liveErrors.clear();
+	showErrors(liveErrors);
 
 	clearObstacles();
 	clearContaminants();
 
-	washColor = QColor::fromHsv(randInt(0, 359), randInt(127, 255), randInt(127, 255), 0xff);
+	Random random(randSeed, streamWash);
+	washColor = QColor::fromHsv(random.randInt(0, 359), random.randInt(127, 255), random.randInt(127, 255), 0xff);
+	washTrips.clear();
+	manualWashes.clear();
+	ui->actionWash->setEnabled(false);
+
+	displayTime = minTime;
+	dataLoaded = true;
+	seekTimeline();
+	on_actionStart_triggered();
+	return true;
+}
 
-	maxTime = (maxTime / 1000) * 1000; // Truncate to seconds (in case any command failed)
+void MainWindow::onLiveUpdated() {
+	qint32 shown = liveErrors.size();
+	liveInput->result(minTime, maxTime, error, liveErrors);
+	addErrors(liveErrors, shown);
 
-	ui->actionStart->setEnabled(true);
-	ui->actionStep->setEnabled(true);
+	// Commands of the last second may still come, so the run is held at the second before it
+	maxTime = (maxTime / 1000) * 1000;
+	if (liveInput->isOpen()) {
+		maxTime = std::min(maxTime, (liveInput->liveTime() - 1) * qint64(1000));
+	}
+	maxTime = std::max(maxTime, minTime);
+	protocolMaxTime = maxTime;
 
-	if (config.hasWash) {
+	if (!timerRun.isActive()) {
+		render();
+	}
+}
+
+void MainWindow::onLiveRefused(const QString &message) {
+	ErrorList errors;
+	errors.push_back(ErrorLog(liveInput->liveTime(), message));
+	addErrors(errors, 0);
+}
+
+void MainWindow::onLiveFinished(const QString &message) {
+	onLiveUpdated();
+	stopLive();
+
+	// The whole protocol is known now, and can be washed
+	occupancyIndex.build(config, droplets);
+	if (config.hasWash && !timerRun.isActive()) {
 		ui->actionWash->setEnabled(true);
+		ui->lblWashObstacleHints->setVisible(true);
+	}
+	if (ui->actionWashOnline->isChecked()) {
+		scheduleOnlineWash();
 	}
+	render();
 
-	displayTime = minTime;
-	dataLoaded = true;
+	if (!message.isEmpty()) {
+		QMessageBox::warning(this, tr("Warning"), tr("The live input broke off: %1").arg(message));
+	}
+}
 
-	this->update();
+void MainWindow::stopLive() {
+	// What came so far stays on display
+	if (liveInput == nullptr) return;
+	liveInput->close();
+	liveInput->deleteLater();
+	liveInput = nullptr;
 }
 
 void MainWindow::render() {
@@ -161,33 +622,43 @@ void MainWindow::render() {
 
 void MainWindow::onRunTimeout() {
 	qint64 thisTime = QDateTime::currentMSecsSinceEpoch();
-	qint64 lastDisplay = displayTime;
 
-	displayTime += (thisTime - lastTime) * runAcceleration;
+	displayTime += (thisTime - lastTime) * runSpeed;
 	lastTime = thisTime;
 
-	auto iter = sounds.lowerBound(lastDisplay / 1000.0);
-	auto jter = sounds.lowerBound(displayTime / 1000.0);
-
-	if (iter != jter) {
-		playSound(iter.value());
+	// Hand upcoming sounds to the mixer slightly ahead of time so that they start exactly on schedule
+	qint64 lookahead = qint64(floor((displayTime + soundLookahead) * ticksPerSecond / 1000.0));
+	if (liveInput != nullptr) {
+		lookahead = std::min(lookahead, maxTime * ticksPerSecond / 1000); // later sounds may still be joined by others
 	}
-
-	auto kter = std::lower_bound(contaminants.begin(), contaminants.end(), lastDisplay / 1000.0, [](Contaminant a, qreal t) -> bool { return a.time < t; });
-	auto lter = std::lower_bound(contaminants.begin(), contaminants.end(), displayTime / 1000.0, [](Contaminant a, qreal t) -> bool { return a.time < t; });
-
-	for (auto it = kter; it != lter; ++it) {
-		contamination[it->x][it->y].insert(it->id);
+	{
+		PROFILE_SCOPE(profiler, StageSounds);
+		for (; soundCursor < timeline.size() && timeline.tick(soundCursor) <= lookahead; ++soundCursor) {
+			if (timeline.type(soundCursor) == EventType::SoundEvent) {
+				mixer.schedule(timeline.sounds(soundCursor), timeline.tick(soundCursor) * 1000 / ticksPerSecond);
+			}
+		}
 	}
 
+	bool finished = false;
 	if (displayTime > maxTime) {
 		displayTime = maxTime;
+		finished = liveInput == nullptr; // live input: wait for the next commands
+	}
+
+	bool failed;
+	{
+		PROFILE_SCOPE(profiler, StageContamination);
+		failed = advanceTimeline(displayTick());
+	}
+
+	if (finished) {
 		on_actionPause_triggered();
 	}
 
-	if (floor(lastDisplay / 1000.0) < error.t && floor(displayTime / 1000.0) >= error.t) {
+	if (failed) {
 		on_actionPause_triggered();
-		sndError.play();
+		mixer.play(sndFxError);
 		QMessageBox::warning(this, tr("Error"), error.msg);
 	}
 
@@ -198,32 +669,44 @@ void MainWindow::on_actionStart_triggered() {
 	timerRun.start();
 	lastTime = QDateTime::currentMSecsSinceEpoch();
 
+	mixer.sync(displayTime, runSpeed);
+	seekTimeline();
+
 	ui->actionStart->setEnabled(false);
 	ui->actionPause->setEnabled(true);
 	ui->actionStep->setEnabled(false);
+	ui->actionFastForward->setEnabled(false);
 	ui->actionRevert->setEnabled(false);
 	ui->actionReset->setEnabled(false);
 
 	ui->actionNewChip->setEnabled(false);
+	ui->actionOpenChip->setEnabled(false);
 	ui->actionLoadCommandFile->setEnabled(false);
+	ui->actionRouteAssay->setEnabled(false);
+	ui->actionCompactCommandFile->setEnabled(false);
 	ui->lblWashObstacleHints->setVisible(false);
 }
 
 void MainWindow::on_actionPause_triggered() {
 	timerRun.stop();
+	mixer.cancel();
 
 	displayTime = qint32(floor(displayTime / 1000.0)) * 1000; // truncate to last second
 
 	ui->actionStart->setEnabled(true);
 	ui->actionPause->setEnabled(false);
 	ui->actionStep->setEnabled(true);
+	ui->actionFastForward->setEnabled(true);
 	ui->actionRevert->setEnabled(true);
 	ui->actionReset->setEnabled(true);
 
 	ui->actionNewChip->setEnabled(true);
+	ui->actionOpenChip->setEnabled(true);
 	ui->actionLoadCommandFile->setEnabled(true);
+	ui->actionRouteAssay->setEnabled(true);
+	ui->actionCompactCommandFile->setEnabled(true);
 
-	if (config.hasWash) {
+	if (config.hasWash && liveInput == nullptr) {
 		ui->actionWash->setEnabled(true);
 		ui->lblWashObstacleHints->setVisible(true);
 	}
@@ -232,37 +715,54 @@ void MainWindow::on_actionPause_triggered() {
 }
 
 void MainWindow::on_actionStep_triggered() {
-	if (displayTime / 1000 == error.t) {
-		on_actionPause_triggered();
-		sndError.play();
-		QMessageBox::warning(this, tr("Error"), error.msg);
-	}
-
 	displayTime = qint32(floor(displayTime / 1000.0) + 1.0) * 1000;
 	displayTime = std::min(displayTime, maxTime);
 
-	auto iter = std::lower_bound(contaminants.begin(), contaminants.end(), displayTime / 1000.0, [](Contaminant a, qreal t) -> bool { return a.time < t; });
-	auto jter = std::upper_bound(contaminants.begin(), contaminants.end(), displayTime / 1000.0, [](qreal t, Contaminant a) -> bool { return t < a.time; });
+	bool failed = advanceTimeline(displayTick());
 
-	for (auto it = iter; it != jter; ++it) {
-		contamination[it->x][it->y].insert(it->id);
+	render();
+
+	if (failed) {
+		mixer.play(sndFxError);
+		QMessageBox::warning(this, tr("Error"), error.msg);
+	}
+}
+
+void MainWindow::on_actionFastForward_triggered() {
+	if (timerRun.isActive()) {
+		on_actionPause_triggered();
 	}
 
+	ContaminationSummary summary;
+	fastForward(config, timeline, maxTime, contamination, summary);
+	displayTime = maxTime;
+	seekTimeline();
+
 	render();
+
+	if (summary.errorTime >= 0) {
+		mixer.play(sndFxError);
+		QMessageBox::warning(this, tr("Error"), error.msg);
+	}
 }
 
 void MainWindow::on_actionRevert_triggered() {
 	displayTime = qint32(ceil(displayTime / 1000.0) - 1.0) * 1000;
 	displayTime = std::max(displayTime, minTime);
+	seekTimeline();
 	render();
 }
 
 void MainWindow::on_actionReset_triggered() {
 	displayTime = minTime;
+	seekTimeline();
 	ui->actionNewChip->setEnabled(true);
+	ui->actionOpenChip->setEnabled(true);
 	ui->actionLoadCommandFile->setEnabled(true);
+	ui->actionRouteAssay->setEnabled(true);
+	ui->actionCompactCommandFile->setEnabled(true);
 
-	if (config.hasWash) {
+	if (config.hasWash && liveInput == nullptr) {
 		ui->actionWash->setEnabled(true);
 		ui->lblWashObstacleHints->setVisible(true);
 	}
@@ -279,22 +779,68 @@ bool MainWindow::eventFilter(QObject *o, QEvent *e) {
 
 			qreal W = p->width(), H = p->height();
 
-			renderPortType(config, W, H, &painter);
-			renderGridAxisNumber(config, W, H, &painter);
+			{
+				PROFILE_SCOPE(profiler, StageFrame);
+				{
+					PROFILE_SCOPE(profiler, StagePortType);
+					renderPortType(config, W, H, &painter);
+				}
+				{
+					PROFILE_SCOPE(profiler, StageAxisNumber);
+					renderGridAxisNumber(config, W, H, &painter);
+				}
 
-			if (dataLoaded) {
-				renderTime(config, displayTime / 1000.0, maxTime / 1000.0, W, H, &painter);
-				renderWashObstacles(config, W, H, obstacles, &painter);
-				renderContaminants(config, W, H, randSeed, droplets, contamination, &painter);
-				renderDroplets(config, droplets, displayTime / 1000.0, W, H, &painter);
-				if (!timerRun.isActive() && displayTime == maxTime) {
-					renderContaminantCount(config, W, H, contamination, &painter);
+				if (dataLoaded) {
+					{
+						PROFILE_SCOPE(profiler, StageTime);
+						renderTime(config, displayTime / 1000.0, maxTime / 1000.0, W, H, &painter);
+					}
+					{
+						PROFILE_SCOPE(profiler, StageWashObstacles);
+						renderWashObstacles(config, W, H, obstacles, &painter);
+					}
+					{
+						PROFILE_SCOPE(profiler, StageContaminants);
+						renderContaminants(config, W, H, randSeed, droplets, contamination, &painter);
+					}
+					{
+						PROFILE_SCOPE(profiler, StageDroplets);
+						renderDroplets(config, droplets, displayTime / 1000.0, W, H, &painter);
+					}
+					{
+						PROFILE_SCOPE(profiler, StageWash);
+						for (qint32 i = 0; i < washTrips.size(); ++i) {
+							qreal t = displayTime / 1000.0 - washTrips[i].start;
+							if (t >= 0 && t <= washTrips[i].steps.size() - 1) {
+								renderWash(config, W, H, t, washTrips[i].steps, washColor, &painter);
+							}
+						}
+					}
+					if (!timerRun.isActive() && displayTime == maxTime) {
+						PROFILE_SCOPE(profiler, StageSummary);
+						renderContaminantCount(config, W, H, contamination, &painter);
+
+						ContaminationSummary summary = summarizeContamination(contamination);
+						summary.errorTime = error.t;
+						renderContaminantSummary(config, W, H, summary, &painter);
+					}
+					if (timerWash.isActive()) {
+						PROFILE_SCOPE(profiler, StageWash);
+						for (qint32 i = 0; i < washRoutes.size(); ++i) {
+							// Spread the hues of the wash droplets evenly around the color wheel
+							QColor color = QColor::fromHsv((washColor.hue() + 360 * i / washRoutes.size()) % 360, washColor.saturation(), washColor.value(), 0xff);
+							renderWash(config, W, H, curWashTime / 1000.0, washRoutes[i], color, &painter);
+						}
+					}
 				}
-				if (timerWash.isActive()) {
-					renderWash(config, W, H, curWashTime / 1000.0, steps, washColor, &painter);
+				{
+					PROFILE_SCOPE(profiler, StageGrid);
+					renderGrid(config, W, H, &painter);
 				}
 			}
-			renderGrid(config, W, H, &painter);
+			if (profiler.overlay()) {
+				renderProfile(profiler, timerRun.interval(), W, H, &painter);
+			}
 			return true;
 		} else if (e->type() == QEvent::MouseButtonPress) {
 			if (timerRun.isActive() || timerWash.isActive() || !config.hasWash) {
@@ -316,9 +862,9 @@ bool MainWindow::eventFilter(QObject *o, QEvent *e) {
 			}
 
 			if (isPortType(X, Y, config, PortType::wash) || isPortType(X, Y, config, PortType::waste)) {
-				obstacles[X][Y] = false;
+				obstacles.set(X, Y, false);
 			} else {
-				obstacles[X][Y] = !obstacles[X][Y];
+				obstacles.set(X, Y, !obstacles.test(X, Y));
 			}
 
 			p->update();
@@ -328,36 +874,33 @@ bool MainWindow::eventFilter(QObject *o, QEvent *e) {
 	return false;
 }
 
-void MainWindow::playSound(qint32 sounds) {
-	sndMove.stop();
-	sndMerge.stop();
-	sndSplit.stop();
-	sndSplitting.stop();
-	if (sounds & sndFxMove) {
-		sndMove.play();
-	}
-	if (sounds & sndFxMerge) {
-		sndMerge.play();
-	}
-	if (sounds & sndFxSplit) {
-		sndSplit.play();
-	}
-	if (sounds & sndFxSplitting) {
-		sndSplitting.play();
-	}
+qint64 MainWindow::displayTick() const {
+	return qint64(floor(displayTime * ticksPerSecond / 1000.0));
 }
 
-void MainWindow::clearObstacles() {
-	obstacles.clear();
-	if (config.rows > 0 && config.columns > 0) {
-		obstacles.resize(config.columns);
-		for (qint32 i = 0; i < config.columns; ++i) {
-			obstacles[i].resize(config.rows);
-			for (qint32 j = 0; j < config.rows; ++j) {
-				obstacles[i][j] = false;
-			}
+void MainWindow::seekTimeline() {
+	// Events of the current tick are regarded as already happened
+	eventCursor = soundCursor = timeline.upperBound(displayTick());
+}
+
+bool MainWindow::advanceTimeline(qint64 tick) {
+	bool failed = false;
+	for (; eventCursor < timeline.size() && timeline.tick(eventCursor) <= tick; ++eventCursor) {
+		if (timeline.type(eventCursor) == EventType::ContaminantEvent) {
+			const Contaminant &c = timeline.contaminant(eventCursor);
+			contamination[c.x][c.y].insert(c.id);
+		} else if (timeline.type(eventCursor) == EventType::WashEvent) {
+			const Position &p = timeline.wash(eventCursor);
+			contamination[p.first][p.second].clear();
+		} else if (timeline.type(eventCursor) == EventType::ErrorEvent) {
+			failed = true;
 		}
 	}
+	return failed;
+}
+
+void MainWindow::clearObstacles() {
+	obstacles = CellMask(config.rows, config.columns);
 }
 
 void MainWindow::clearContaminants() {
@@ -372,180 +915,76 @@ void MainWindow::clearContaminants() {
 	}
 }
 
-bool MainWindow::wash(QVector<Position> &steps) {
-	// Step 1: mark obstacles
-	auto ob = obstacles;
+void MainWindow::replayTimeline() {
+	// Contamination up to the displayed moment
+	clearContaminants();
+	eventCursor = 0;
+	advanceTimeline(displayTick());
+	soundCursor = eventCursor;
+}
+
+bool MainWindow::wash(QVector<QVector<Position>> &routes) {
+	// Step 1: mark obstacles: cells covered by live droplets, dilated by one cell
+	CellMask occupied(config.rows, config.columns);
 	for (qint32 i = 0; i < droplets.size(); ++i) {
 		DropletStatus pos;
 		qreal x, y;
 		if (getRealTimeStatus(droplets[i], displayTime / 1000.0, pos, x, y)) {
-			for (qint32 dX = qint32(ceil(x - pos.rx)); dX <= qint32(floor(x + pos.rx)); ++dX) {
-				for (qint32 dY = qint32(ceil(y - pos.ry)); dY <= qint32(floor(y + pos.ry)); ++dY) {
-					for (qint32 k = 0; k < 8; ++k) {
-						qint32 xx = dX + dirX[k], yy = dY + dirY[k];
-						if (xx >= 0 && xx < config.columns && yy >= 0 && yy < config.rows) {
-							ob[xx][yy] = true;
-						}
-						ob[pos.x][pos.y] = true;
-					}
-				}
-			}
-		}
-	}
-	// Step 2: find [wash input] and [waste] ports
-	qint32 sx = -1, sy = -1, tx = -1, ty = -1;
-	for (qint32 i = 0; i < config.columns; ++i) {
-		for (qint32 j = 0; j < config.rows; ++j) {
-			if (isPortType(i, j, config, PortType::wash)) {
-				sx = i;
-				sy = j;
-			} else if (isPortType(i, j, config, PortType::waste)) {
-				tx = i;
-				ty = j;
-			}
+			occupied.setRect(qint32(floor(x - pos.rx + 0.5)), qint32(floor(y - pos.ry + 0.5)), qint32(ceil(x + pos.rx - 0.5)), qint32(ceil(y + pos.ry - 0.5)));
+			occupied.setRect(pos.x, pos.y, pos.x, pos.y);
 		}
 	}
-	assert(sx >= 0 && sy >= 0 && tx >= 0 && ty >= 0);
-	if (ob[sx][sy] || ob[tx][ty]) {
-		QMessageBox::warning(this, tr("Error washing"), tr("Cannot wash the chip: no valid route."));
-		return false;
-	}
-	// Step 3: initialize [distance] matrix
-	QVector<QVector<qint32>> distance;
-	distance.resize(config.columns);
-	for (qint32 i = 0; i < config.columns; ++i) {
-		distance[i].resize(config.rows);
-		for (qint32 j = 0; j < config.rows; ++j) {
-			distance[i][j] = -1;
-		}
-	}
-	distance[sx][sy] = 0;
-	// Step 4: find the route
-	QVector<QVector<bool>> washed;
-	washed.resize(config.columns);
-	for (qint32 i = 0; i < config.columns; ++i) {
-		washed[i].resize(config.rows);
-		for (qint32 j = 0; j < config.rows; ++j) {
-			washed[i][j] = false;
-		}
-	}
-
-	steps.clear();
-	QQueue<Position> queue;
-	queue.enqueue(Position(sx, sy));
-	steps.push_back(Position(sx, sy));
-
-	qint32 ssx = sx, ssy = sy;
-	moveToPort(ssx, ssy, config);
-	steps.push_front(Position(ssx, ssy));
-	while (!queue.empty()) {
-		Position pos = queue.dequeue();
-		for (qint32 k = 0; k < 4; ++k) {
-			qint32 nx = pos.first + dirX[k], ny = pos.second + dirY[k];
-			if (nx < 0 || nx >= config.columns || ny < 0 || ny >= config.rows) {
-				continue;
-			}
-			if (ob[nx][ny]) {
-				continue;
-			}
-			if (distance[nx][ny] == -1 || distance[nx][ny] > distance[pos.first][pos.second] + 1) {
-				distance[nx][ny] = distance[pos.first][pos.second] + 1;
-
-				if (contamination[nx][ny].size() > 0 && !washed[nx][ny]) {
-					washRoute(config, steps, nx, ny, ob);
-					washed[nx][ny] = true;
-					queue.push_front(Position(nx, ny));
-				} else {
-					queue.enqueue(Position(nx, ny));
+	CellMask ob = occupied.dilated();
+	ob |= obstacles;
+	// Step 2: collect contaminated cells, or only those a different droplet will pass later
+	QVector<Position> targets;
+	if (ui->actionWashOnDemand->isChecked()) {
+		ContaminationMap occupancy;
+		futureOccupancy(config, droplets, displayTime / 1000.0, occupancy);
+		targets = demandedCells(contamination, occupancy);
+	} else {
+		for (qint32 x = 0; x < config.columns; ++x) {
+			for (qint32 y = 0; y < config.rows; ++y) {
+				if (contamination[x][y].size() > 0) {
+					targets.push_back(Position(x, y));
 				}
 			}
 		}
 	}
-	if (distance[tx][ty] == -1) {
-		QMessageBox::warning(this, tr("Error washing"), tr("Cannot wash the chip: no valid route."));
-		return false;
-	}
-	if (steps.size() <= 2 && !contamination[sx][sy].size()) {
-		QMessageBox::information(this, tr("Hint"), tr("Nothing to wash."));
-		return false;
-	}
-	washRoute(config, steps, tx, ty, ob);
-	moveToPort(tx, ty, config);
-	steps.push_back(Position(tx, ty));
-
-	return true;
-}
-
-void MainWindow::washRoute(const ChipConfig &config, QVector<Position> &steps, qint32 tx, qint32 ty, const QVector<QVector<bool>> &obstacles) {
-	QVector<QVector<qint32>> distance;
-	QVector<QVector<qint32>> ancestor;
-	distance.resize(config.columns);
-	for (qint32 i = 0; i < config.columns; ++i) {
-		distance[i].resize(config.rows);
-		for (qint32 j = 0; j < config.rows; ++j) {
-			distance[i][j] = -1;
+	// Step 3: plan the routes
+	switch (planner.planFleet(config, ob, targets, washDroplets, routes)) {
+		case WashPlanner::NoRoute: {
+			QMessageBox::warning(this, tr("Error washing"), tr("Cannot wash the chip: no valid route."));
+			return false;
 		}
-	}
-	ancestor.resize(config.columns);
-	for (qint32 i = 0; i < config.columns; ++i) {
-		ancestor[i].resize(config.rows);
-		for (qint32 j = 0; j < config.rows; ++j) {
-			ancestor[i][j] = -1;
+		case WashPlanner::NothingToWash: {
+			QMessageBox::information(this, tr("Hint"), tr("Nothing to wash."));
+			return false;
 		}
-	}
-	auto iter = steps.back();
-	QQueue<Position> queue;
-	queue.push_back(iter);
-	distance[iter.first][iter.second] = 0;
-	while (!queue.empty()) {
-		Position pos = queue.dequeue();
-		for (qint32 k = 0; k < 4; ++k) {
-			Position npos(pos.first + dirX[k], pos.second + dirY[k]);
-			if (npos.first < 0 || npos.first >= config.columns || npos.second < 0 || npos.second >= config.rows) {
-				continue;
-			}
-			if (obstacles[npos.first][npos.second]) {
-				continue;
-			}
-			if (distance[npos.first][npos.second] == -1 || distance[npos.first][npos.second] > distance[pos.first][pos.second] + 1) {
-				distance[npos.first][npos.second] = distance[pos.first][pos.second] + 1;
-				ancestor[npos.first][npos.second] = k;
-				queue.enqueue(npos);
-				if (npos.first == tx && npos.second == ty) {
-					queue.clear();
-					break;
-				}
-			}
+		case WashPlanner::Planned: {
+			break;
 		}
 	}
-	if (distance[tx][ty] == -1) {
-		QMessageBox::warning(this, tr("Failed!"), tr("Assertion failed!"));
-	}
-	QStack<Position> stk;
-	for (qint32 x = tx, y = ty; x != iter.first || y != iter.second; ) {
-		stk.push(Position(x, y));
-		qint32 dir = ancestor[x][y];
-		x -= dirX[dir];
-		y -= dirY[dir];
-	}
-	while (!stk.empty()) {
-		steps.push_back(stk.pop());
-	}
+	return true;
 }
 
 void MainWindow::on_actionWash_triggered() {
 	if (timerRun.isActive()) {
 		on_actionPause_triggered();
 	}
-	if (wash(steps)) {
+	if (wash(washRoutes)) {
 		lastWashTime = QDateTime::currentMSecsSinceEpoch();
 		curWashTime = 0;
 
 		ui->actionNewChip->setEnabled(false);
+		ui->actionOpenChip->setEnabled(false);
 		ui->actionLoadCommandFile->setEnabled(false);
+		ui->actionRouteAssay->setEnabled(false);
+		ui->actionCompactCommandFile->setEnabled(false);
 		ui->actionStart->setEnabled(false);
 		ui->actionPause->setEnabled(false);
 		ui->actionStep->setEnabled(false);
+		ui->actionFastForward->setEnabled(false);
 		ui->actionRevert->setEnabled(false);
 		ui->actionReset->setEnabled(false);
 
@@ -562,14 +1001,18 @@ void MainWindow::onWashTimeout() {
 	curWashTime += (thisWashTime - lastWashTime) * washAcceleration;
 	lastWashTime = thisWashTime;
 
-	if (curWashTime >= (steps.size() - 1) * 1000) {
-		curWashTime = (steps.size() - 1) * 1000;
+	if (curWashTime >= planner.routeLength() * 1000) {
+		curWashTime = planner.routeLength() * 1000;
 
 		ui->actionNewChip->setEnabled(true);
+		ui->actionOpenChip->setEnabled(true);
 		ui->actionLoadCommandFile->setEnabled(true);
+		ui->actionRouteAssay->setEnabled(true);
+		ui->actionCompactCommandFile->setEnabled(true);
 		ui->actionStart->setEnabled(true);
 		ui->actionPause->setEnabled(false);
 		ui->actionStep->setEnabled(true);
+		ui->actionFastForward->setEnabled(true);
 		ui->actionRevert->setEnabled(true);
 		ui->actionReset->setEnabled(true);
 
@@ -582,14 +1025,116 @@ void MainWindow::onWashTimeout() {
 	if (lastDisplayWashTime / 1000 != curWashTime / 1000) {
 		clearContamination(qint32(curWashTime / 1000));
 	}
+	if (!timerWash.isActive()) {
+		// The washed cells are part of the timeline now, so seeking and fast-forward keep them clean
+		timeline.finalize();
+		seekTimeline();
+	}
+
+	if (!timerWash.isActive() && !pendingProtocol.isNull()) {
+		applyProtocol(pendingProtocol);
+		pendingProtocol.clear();
+	}
 
 	ui->picDisplay->update();
 }
 
 void MainWindow::clearContamination(qint32 second) {
-	if (second + 1 >= steps.size()) { // back() element is the waste port (which is out of range)
+	for (qint32 i = 0; i < washRoutes.size(); ++i) {
+		if (second >= washRoutes[i].size()) {
+			continue;
+		}
+		Position pos = washRoutes[i][second];
+		if (pos.first < 0 || pos.first >= config.columns || pos.second < 0 || pos.second >= config.rows) {
+			continue; // waiting at the wash port or gone through the waste port
+		}
+		contamination[pos.first][pos.second].clear();
+		timeline.addWash(qint32(displayTime / 1000), pos.first, pos.second); // the run is paused during the wash
+		manualWashes.push_back(qMakePair(qint32(displayTime / 1000), pos));
+	}
+}
+
+void MainWindow::addManualWashes(qint64 after) {
+	// Put back the washes run by hand after the tick, which a reload or a new schedule of the online wash dropped
+	qint32 from = timeline.size();
+	for (const QPair<qint32, Position> &w : manualWashes) {
+		if (Timeline::toTick(w.first) > after) {
+			timeline.addWash(w.first, w.second.first, w.second.second);
+		}
+	}
+	if (timeline.size() > from) {
+		timeline.finalize();
+	}
+}
+
+void MainWindow::on_actionWashOnline_toggled(bool checked) {
+	Q_UNUSED(checked);
+	if (!dataLoaded) return;
+	if (timerRun.isActive()) {
+		on_actionPause_triggered();
+	}
+	scheduleOnlineWash();
+	render();
+}
+
+void MainWindow::scheduleOnlineWash() {
+	// Drop the trips of the previous schedule, but not the washes already done
+	timeline.removeWashes(displayTick());
+	addManualWashes(displayTick());
+	washTrips.clear();
+	maxTime = protocolMaxTime;
+
+	// The droplets of a live protocol are not known ahead, so it is washed once its input has ended
+	if (config.hasWash && ui->actionWashOnline->isChecked() && liveInput == nullptr) {
+		QVector<WashDemand> demands = washDemands(config, droplets, timeline, contamination, displayTime / 1000.0);
+		qint32 missed = 0;
+		planner.planOnline(config, obstacles, occupancyIndex, demands, std::max(qint32(ceil(displayTime / 1000.0)), 0), washTrips, missed);
+
+		for (qint32 i = 0; i < washTrips.size(); ++i) {
+			const WashTrip &trip = washTrips[i];
+			for (qint32 j = 0; j < trip.steps.size(); ++j) {
+				const Position &p = trip.steps[j];
+				if (p.first >= 0 && p.first < config.columns && p.second >= 0 && p.second < config.rows) {
+					timeline.addWash(trip.start + j, p.first, p.second);
+				}
+			}
+			maxTime = std::max(maxTime, qint64(trip.start + trip.steps.size() - 1) * 1000);
+		}
+		timeline.finalize();
+
+		if (missed > 0) {
+			QMessageBox::information(this, tr("Hint"), tr("%1 contaminated cell(s) cannot be washed in time during the run.").arg(missed));
+		}
+	}
+	seekTimeline();
+}
+
+void MainWindow::on_actionWashDroplets_triggered() {
+	bool ok = false;
+	qint32 count = QInputDialog::getInt(this, tr("Wash Droplets"), tr("Number of wash droplets running at the same time:"), washDroplets, 1, maxWashDroplets, 1, &ok);
+	if (ok) {
+		washDroplets = count;
+	}
+}
+
+void MainWindow::on_actionProfilerOverlay_toggled(bool checked) {
+	profiler.setOverlay(checked);
+	render();
+}
+
+void MainWindow::on_actionRecordTrace_toggled(bool checked) {
+	if (checked) {
+		profiler.startTrace();
 		return;
 	}
-	Position pos = steps[second];
-	contamination[pos.first][pos.second].clear();
+
+	QString url = QFileDialog::getSaveFileName(this, tr("Save Trace"), "", tr("Trace Files (*.json)"));
+	if (url.isEmpty()) {
+		profiler.stopTrace();
+		return;
+	}
+	QString message;
+	if (!profiler.saveTrace(url, message)) {
+		QMessageBox::warning(this, tr("Error"), message);
+	}
 }
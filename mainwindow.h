@@ -3,12 +3,19 @@
 
 #include <QSet>
 #include <QUrl>
-#include <QSound>
 #include <QTimer>
+#include <QThread>
 #include <QDateTime>
+#include <QListWidgetItem>
+#include <QFileSystemWatcher>
 #include <QMainWindow>
 
 #include "utility.h"
+#include "soundmixer.h"
+#include "washplanner.h"
+#include "profiler.h"
+#include "loadworker.h"
+#include "liveinput.h"
 
 namespace Ui {
 	class MainWindow;
@@ -21,6 +28,15 @@ public:
     explicit MainWindow(QWidget *parent = nullptr);
     ~MainWindow();
 
+	// Startup from the command line
+	bool openChip(const QString &url);
+	void openCommandFile(const QString &url, bool autoplay);
+	void setRunSpeed(qreal speed);
+	void setReportAllErrors(bool on);
+	void setContaminationWeight(qint32 weight);
+	void setSeed(quint64 seed);
+	bool startLive(const QString &source, bool socket); // commands from stdin ("-"), a named pipe or a local socket
+
 protected:
 	void dragEnterEvent(QDragEnterEvent *e);
 	void dropEvent(QDropEvent *e);
@@ -32,15 +48,39 @@ private slots:
 
 	void onDlgNewChipAccepted(qint32 rows, qint32 columns);
 	void onDlgConfigChipAccepted(const ChipConfig &config);
+	void resetChip();
+	void applyChip(const ChipConfig &config);
+	void on_actionOpenChip_triggered();
+	void on_actionSaveChip_triggered();
 
 	void on_actionExit_triggered();
 
 	void on_actionAboutDmfbSimulator_triggered();
 
 	void loadFile(const QString &url);
+	void onLoadProgress(qint32 id, qint64 bytes, qint64 totalBytes, qint32 commands, qint32 totalCommands);
+	void onLoaded(qint32 id, QSharedPointer<LoadedProtocol> protocol);
+	void applyProtocol(const QSharedPointer<LoadedProtocol> &protocol);
+	void cancelLoading();
+	void on_btnCancelLoading_clicked();
 	void selectFile();
 	void render();
 	void on_actionLoadCommandFile_triggered();
+	void on_actionRandomSeed_triggered();
+	quint64 nextSeed() const;
+	void on_actionRouteAssay_triggered();
+	void on_actionCompactCommandFile_triggered();
+	void showErrors(const ErrorList &errors);
+	void addErrors(const ErrorList &errors, qint32 from);
+	void on_listErrors_itemActivated(QListWidgetItem *item);
+	void onCommandFileChanged(const QString &url);
+	void onReloadTimeout();
+	void watchFiles();
+	bool saveCommandFile(const QStringList &commands);
+	void onLiveUpdated();
+	void onLiveRefused(const QString &message);
+	void onLiveFinished(const QString &message);
+	void stopLive();
 
 	void onRunTimeout();
 	void onWashTimeout();
@@ -50,18 +90,29 @@ private slots:
 
 	void on_actionStep_triggered();
 
+	void on_actionFastForward_triggered();
+
 	void on_actionRevert_triggered();
 
 	void on_actionReset_triggered();
 
-	void playSound(qint32 sounds);
 	void clearContaminants();
+	void replayTimeline();
+	qint64 displayTick() const;
+	void seekTimeline();
+	bool advanceTimeline(qint64 tick);
 	void clearObstacles();
-	bool wash(QVector<Position> &steps);
-	void washRoute(const ChipConfig &config, QVector<Position> &steps, qint32 tx, qint32 ty, const QVector<QVector<bool>> &obstacles);
+	bool wash(QVector<QVector<Position>> &routes);
 	void on_actionWash_triggered();
+	void on_actionWashDroplets_triggered();
+	void on_actionWashOnline_toggled(bool checked);
+	void scheduleOnlineWash();
 
 	void clearContamination(qint32 second);
+	void addManualWashes(qint64 after);
+
+	void on_actionProfilerOverlay_toggled(bool checked);
+	void on_actionRecordTrace_toggled(bool checked);
 
 private:
 	Ui::MainWindow *ui;
@@ -71,29 +122,61 @@ private:
 	ChipConfig config;
 
 	// Sound Effects
-	QSound sndMove, sndMerge, sndSplitting, sndSplit, sndError;
-	SoundList sounds;
+	SoundMixer mixer;
 
 	// Error Info
 	ErrorLog error;
 
+	// Command File
+	QThread loadThread;
+	LoadWorker *loadWorker;
+	qint32 loadId; // id of the last load requested
+	bool loading;
+	bool reloading; // the load in progress reloads the command file on display
+	bool autoplay; // start the run once the load in progress is done
+	QSharedPointer<LoadedProtocol> pendingProtocol; // loaded during a wash, taken over after it
+	QString loadHint; // shown once the load in progress is done, with the length of the protocol as the last argument
+	qint32 contaminationWeight; // of the assay router, in seconds
+	ProtocolLoader loader;
+	QString commandFile;
+	QFileSystemWatcher watcher;
+	QTimer timerReload; // waits for the writes of a save to settle
+	LiveInput *liveInput; // commands coming while the protocol runs, null if none
+	ErrorList liveErrors; // those of the live protocol shown in the list
+
+	// Events
+	Timeline timeline;
+	qint32 eventCursor; // next event to apply
+	qint32 soundCursor; // next event to hand to the sound mixer
+
 	// Contamination
-	ContaminantList contaminants;
-	QVector<QVector<QSet<qint32>>> contamination;
-	quint32 randSeed;
+	ContaminationMap contamination;
+	quint64 randSeed; // seed of the droplet colours, the wash colour and the contamination dots
+	bool seedFixed; // every load and live run takes fixedSeed, else a seed from the clock
+	quint64 fixedSeed;
 
 	// Run Timer
 	QTimer timerRun;
 	qint64 lastTime, displayTime;
+	qreal runSpeed; // simulated seconds per second
 	qint64 minTime, maxTime;
+	qint64 protocolMaxTime; // maxTime without the trips of the online wash
 	QVector<Droplet> droplets;
+	OccupancyIndex occupancyIndex; // cells covered by the droplets at every second
 
 	// Wash
 	QTimer timerWash;
-	QVector<QVector<bool>> obstacles;
-	QVector<Position> steps;
+	WashPlanner planner;
+	CellMask obstacles;
+	QVector<QVector<Position>> washRoutes; // one route per wash droplet, all of the same length
+	qint32 washDroplets; // number of wash droplets running at the same time
+	QVector<WashTrip> washTrips; // trips of the online wash, during the run of the protocol
+	QVector<QPair<qint32, Position>> manualWashes; // (second, cell) of the washes run by hand, kept when the timeline is rebuilt
 	qint64 lastWashTime, curWashTime;
 	QColor washColor;
+
+	// Profiler
+	Profiler profiler;
 };
 
 #endif // MAINWINDOW_H
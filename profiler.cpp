@@ -0,0 +1,119 @@
+#include "profiler.h"
+
+#include <QFile>
+#include <QTextStream>
+
+const qint32 Profiler::window;
+const qint32 Profiler::maxTraceEvents;
+
+Profiler::Profiler() : overlayOn(false), traceOn(false), current(ProfileStageCount, 0), history(window * ProfileStageCount, 0), frameEnds(window, 0), frames(0) {
+	clock.start();
+}
+
+bool Profiler::isActive() const {
+	return overlayOn || traceOn;
+}
+
+bool Profiler::overlay() const {
+	return overlayOn;
+}
+
+void Profiler::setOverlay(bool on) {
+	overlayOn = on;
+	// Start the statistics afresh rather than mixing in frames from before
+	current.fill(0);
+	frames = 0;
+}
+
+bool Profiler::tracing() const {
+	return traceOn;
+}
+
+void Profiler::startTrace() {
+	trace.clear();
+	traceOn = true;
+}
+
+void Profiler::stopTrace() {
+	traceOn = false;
+	trace.clear();
+}
+
+bool Profiler::saveTrace(const QString &url, QString &message) {
+	traceOn = false;
+
+	QFile file(url);
+	if (!file.open(QFile::WriteOnly | QFile::Text)) {
+		message = QString("Cannot write %1.").arg(url);
+		return false;
+	}
+	QTextStream fs(&file);
+
+	// Complete events, with times in microseconds
+	fs << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+	for (qint32 i = 0; i < trace.size(); ++i) {
+		const TraceEvent &e = trace[i];
+		fs << "{\"name\":\"" << name(e.stage) << "\",\"cat\":\"" << (e.stage == StageFrame ? "frame" : "stage")
+		   << "\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":" << QString::number(e.start / 1000.0, 'f', 3)
+		   << ",\"dur\":" << QString::number(e.duration / 1000.0, 'f', 3) << (i + 1 < trace.size() ? "},\n" : "}\n");
+	}
+	fs << "]}\n";
+	trace.clear();
+	return true;
+}
+
+qint64 Profiler::now() const {
+	return clock.nsecsElapsed();
+}
+
+void Profiler::record(ProfileStage stage, qint64 start, qint64 end) {
+	if (traceOn && trace.size() < maxTraceEvents) {
+		trace.push_back({stage, start, end - start});
+	}
+	if (!overlayOn) return;
+
+	current[stage] += end - start;
+	if (stage == StageFrame) {
+		// A frame gathers the stages timed since the frame before, including the updates of the run timer
+		qint32 slot = frames % window;
+		for (qint32 s = 0; s < ProfileStageCount; ++s) {
+			history[slot * ProfileStageCount + s] = current[s];
+		}
+		frameEnds[slot] = end;
+		current.fill(0);
+		++frames;
+	}
+}
+
+qreal Profiler::mean(ProfileStage stage) const {
+	qint32 n = std::min(frames, window);
+	if (n == 0) return 0;
+	qint64 sum = 0;
+	for (qint32 i = 0; i < n; ++i) {
+		sum += history[i * ProfileStageCount + stage];
+	}
+	return sum / 1e6 / n;
+}
+
+qreal Profiler::peak(ProfileStage stage) const {
+	qint64 best = 0;
+	for (qint32 i = 0; i < std::min(frames, window); ++i) {
+		best = std::max(best, history[i * ProfileStageCount + stage]);
+	}
+	return best / 1e6;
+}
+
+qreal Profiler::frameInterval() const {
+	qint32 n = std::min(frames, window);
+	if (n < 2) return 0;
+	qint32 last = (frames - 1) % window, first = (frames - n) % window;
+	return (frameEnds[last] - frameEnds[first]) / 1e6 / (n - 1);
+}
+
+const char *Profiler::name(ProfileStage stage) {
+	static const char *names[ProfileStageCount] = {
+		"renderPortType", "renderGridAxisNumber", "renderTime", "renderWashObstacles", "renderContaminants", "renderDroplets", "renderWash",
+		"renderContaminantSummary", "renderGrid", "sounds", "contamination", "frame"
+	};
+	return names[stage];
+}
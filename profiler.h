@@ -0,0 +1,82 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <QString>
+#include <QVector>
+#include <QElapsedTimer>
+
+// Timers of the stages of a frame, for the profiler overlay and for Chrome traces (chrome://tracing).
+// While neither is on, a timer costs a branch; DEFINES += DMFB_NO_PROFILER removes the timers altogether.
+
+enum ProfileStage {
+	StagePortType, StageAxisNumber, StageTime, StageWashObstacles, StageContaminants, StageDroplets, StageWash,
+	StageSummary, StageGrid, StageSounds, StageContamination, StageFrame, ProfileStageCount
+};
+
+class Profiler {
+public:
+	Profiler();
+
+	bool isActive() const; // whether the timers record anything
+	bool overlay() const;
+	void setOverlay(bool on);
+	bool tracing() const;
+	void startTrace();
+	void stopTrace(); // drops the events
+	bool saveTrace(const QString &url, QString &message); // stops tracing
+
+	qint64 now() const; // in nanoseconds
+	void record(ProfileStage stage, qint64 start, qint64 end);
+
+	// Statistics of the last frames, in milliseconds
+	qreal mean(ProfileStage stage) const;
+	qreal peak(ProfileStage stage) const;
+	qreal frameInterval() const; // mean time from one frame to the next
+
+	static const char *name(ProfileStage stage);
+
+private:
+	struct TraceEvent {
+		ProfileStage stage;
+		qint64 start, duration;
+	};
+
+	static const qint32 window = 120; // frames kept for the statistics
+	static const qint32 maxTraceEvents = 4000000;
+
+	QElapsedTimer clock;
+	bool overlayOn, traceOn;
+	QVector<qint64> current; // time of every stage in the frame being drawn
+	QVector<qint64> history; // [frame * ProfileStageCount + stage], the last window frames
+	QVector<qint64> frameEnds; // the same frames
+	qint32 frames; // frames recorded in all
+	QVector<TraceEvent> trace;
+};
+
+class ProfileScope {
+public:
+	ProfileScope(Profiler &profiler, ProfileStage stage);
+	~ProfileScope();
+
+private:
+	Profiler &profiler;
+	ProfileStage stage;
+	qint64 start; // -1 if not recording
+};
+
+inline ProfileScope::ProfileScope(Profiler &profiler, ProfileStage stage) : profiler(profiler), stage(stage), start(profiler.isActive() ? profiler.now() : -1) {}
+
+inline ProfileScope::~ProfileScope() {
+	if (start >= 0) {
+		profiler.record(stage, start, profiler.now());
+	}
+}
+
+// Times the rest of the enclosing block
+#ifdef DMFB_NO_PROFILER
+#define PROFILE_SCOPE(profiler, stage)
+#else
+#define PROFILE_SCOPE(profiler, stage) ProfileScope profileScope(profiler, stage)
+#endif
+
+#endif // PROFILER_H
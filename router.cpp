@@ -0,0 +1,730 @@
+#include "router.h"
+
+#include <queue>
+#include <tuple>
+#include <limits>
+
+#include <QSet>
+#include <QFile>
+#include <QHash>
+#include <QTextStream>
+#include <QElapsedTimer>
+
+static const qint32 never = std::numeric_limits<qint32>::max();
+static const qint32 mergeTries = 8; // candidate spots of a merge routed before giving up
+static const qint64 maxSearchStates = 1 << 25; // (cell, second) states of a search, 13 bytes each
+
+static const char *operationNames[] = {"input", "output", "merge", "mix", "split"};
+
+bool loadAssay(const QString &url, const ChipConfig &config, QVector<AssayOperation> &assay, QString &message) {
+	QFile file(url);
+	if (!file.open(QFile::ReadOnly | QFile::Text)) {
+		message = QString("Cannot open %1.").arg(url);
+		return false;
+	}
+	QTextStream fs(&file);
+
+	QSet<QString> produced, consumed;
+	assay.clear();
+
+	for (qint32 line = 1; !fs.atEnd(); ++line) {
+		QStringList tokens = fs.readLine()
+							   .replace(',', ' ')
+							   .replace(';', ' ')
+							   .simplified()
+							   .toLower()
+							   .split(' ', QString::SkipEmptyParts);
+
+		if (tokens.empty()) continue;
+
+		AssayOperation op;
+		op.line = line;
+		op.x = op.y = -1;
+		op.steps = 0;
+		bool ok = tokens.size() == 4;
+
+		if (tokens[0] == "input" || tokens[0] == "output") {
+			bool isInput = tokens[0] == "input";
+			op.type = isInput ? InputOperation : OutputOperation;
+			ok = tokens.size() == 2 || tokens.size() == 4;
+			if (ok) {
+				(isInput ? op.produces : op.consumes).push_back(tokens[1]);
+			}
+			if (ok && tokens.size() == 4) {
+				bool okX = false, okY = false;
+				op.x = tokens[2].toInt(&okX) - 1;
+				op.y = config.rows - tokens[3].toInt(&okY);
+				bool inside = okX && okY && op.x >= 0 && op.x < config.columns && op.y >= 0 && op.y < config.rows;
+				if (!inside || !isPortType(op.x, op.y, config, isInput ? PortType::input : PortType::output)) {
+					message = QString("Line %1: (%2, %3) is not beside an %4 port.").arg(line).arg(tokens[2]).arg(tokens[3]).arg(tokens[0]);
+					return false;
+				}
+			}
+		} else if (tokens[0] == "merge") {
+			op.type = MergeOperation;
+			if (ok) {
+				op.produces << tokens[1];
+				op.consumes << tokens[2] << tokens[3];
+			}
+		} else if (tokens[0] == "mix") {
+			op.type = MixOperation;
+			if (ok) {
+				op.produces << tokens[1];
+				op.consumes << tokens[2];
+				op.steps = tokens[3].toInt(&ok);
+				ok = ok && op.steps > 0;
+			}
+		} else if (tokens[0] == "split") {
+			op.type = SplitOperation;
+			if (ok) {
+				op.produces << tokens[1] << tokens[2];
+				op.consumes << tokens[3];
+			}
+		} else {
+			message = QString("Line %1: unknown operation \"%2\".").arg(line).arg(tokens[0]);
+			return false;
+		}
+
+		if (!ok) {
+			message = QString("Line %1: wrong arguments of %2.").arg(line).arg(tokens[0]);
+			return false;
+		}
+
+		// Every droplet is produced by exactly one operation and consumed by at most one
+		for (qint32 i = 0; i < op.produces.size(); ++i) {
+			if (produced.contains(op.produces[i])) {
+				message = QString("Line %1: droplet %2 is produced twice.").arg(line).arg(op.produces[i]);
+				return false;
+			}
+			produced.insert(op.produces[i]);
+		}
+		for (qint32 i = 0; i < op.consumes.size(); ++i) {
+			if (consumed.contains(op.consumes[i])) {
+				message = QString("Line %1: droplet %2 is consumed twice.").arg(line).arg(op.consumes[i]);
+				return false;
+			}
+			consumed.insert(op.consumes[i]);
+		}
+
+		assay.push_back(op);
+	}
+
+	for (qint32 i = 0; i < assay.size(); ++i) {
+		for (qint32 j = 0; j < assay[i].consumes.size(); ++j) {
+			if (!produced.contains(assay[i].consumes[j])) {
+				message = QString("Line %1: droplet %2 is never produced.").arg(assay[i].line).arg(assay[i].consumes[j]);
+				return false;
+			}
+		}
+	}
+
+	if (assay.empty()) {
+		message = QString("The assay is empty.");
+		return false;
+	}
+	return true;
+}
+
+AssayRouter::AssayRouter(qint32 contaminationWeight) : contaminationWeight(contaminationWeight), rows(0), columns(0), spacious(true), finish(0), elapsed(0), tooLarge(false) {}
+
+bool AssayRouter::route(const ChipConfig &config, const QVector<AssayOperation> &assay, QStringList &commands, QString &message) {
+	QElapsedTimer timer;
+	timer.start();
+
+	rows = config.rows;
+	columns = config.columns;
+	inputs.clear();
+	outputs.clear();
+	for (qint32 x = 0; x < columns; ++x) {
+		for (qint32 y = 0; y < rows; ++y) {
+			if (isPortType(x, y, config, PortType::input)) {
+				inputs.push_back(x * rows + y);
+			} else if (isPortType(x, y, config, PortType::output)) {
+				outputs.push_back(x * rows + y);
+			}
+		}
+	}
+
+	nearPort.fill(false, rows * columns);
+	QVector<qint32> ports = inputs;
+	ports += outputs;
+	for (qint32 i = 0; i < ports.size(); ++i) {
+		qint32 x = ports[i] / rows, y = ports[i] % rows;
+		for (qint32 xx = std::max(x - 1, 0); xx <= std::min(x + 1, columns - 1); ++xx) {
+			for (qint32 yy = std::max(y - 1, 0); yy <= std::min(y + 1, rows - 1); ++yy) {
+				nearPort[xx * rows + yy] = true;
+			}
+		}
+	}
+
+	plan = Plan();
+	plan.lastBusy.fill(-1, rows * columns);
+	plan.residue.fill(-1, rows * columns);
+	plan.crossings = 0;
+	agentOf.clear();
+	finish = 0;
+	updateParks();
+	commands.clear();
+
+	QVector<bool> done(assay.size(), false);
+	for (qint32 remaining = assay.size(); remaining > 0; --remaining) {
+		// Take the first operation in the assay whose droplets exist. Planning order is not execution order:
+		// an operation planned later still runs as early as the reservations leave room for it.
+		qint32 next = -1;
+		for (qint32 i = 0; i < assay.size() && next < 0; ++i) {
+			if (done[i]) continue;
+			bool available = true;
+			for (qint32 j = 0; j < assay[i].consumes.size() && available; ++j) {
+				available = agentOf.contains(assay[i].consumes[j]);
+			}
+			if (available) {
+				next = i;
+			}
+		}
+		if (next < 0) {
+			for (qint32 i = 0; i < assay.size() && next < 0; ++i) {
+				if (!done[i]) next = i;
+			}
+			message = QString("Line %1: circular dependency between operations.").arg(assay[next].line);
+			return false;
+		}
+		done[next] = true;
+
+		const AssayOperation &op = assay[next];
+		if (op.type == InputOperation) {
+			// Droplets are dispensed lazily, by the operation consuming them
+			Agent agent;
+			agent.cell = -1;
+			agent.ready = -1; // so that the first Input is at second 0
+			agent.parked = false;
+			agent.ports = op.x >= 0 ? QVector<qint32>({op.x * rows + op.y}) : inputs;
+			if (agent.ports.empty()) {
+				message = QString("Line %1: no input port on the chip.").arg(op.line);
+				return false;
+			}
+			agentOf[op.produces[0]] = plan.agents.size();
+			plan.lineage.push_back(plan.agents.size());
+			plan.agents.push_back(agent);
+			continue;
+		}
+		if (op.type == OutputOperation && op.x < 0 && outputs.empty()) {
+			message = QString("Line %1: no output port on the chip.").arg(op.line);
+			return false;
+		}
+
+		// Waiting droplets may block a port or wall in others for good, so first try to keep them apart
+		Plan saved = plan;
+		spacious = true;
+		tooLarge = false;
+		bool ok = routeOperation(op);
+		if (!ok && !tooLarge) {
+			plan = saved;
+			updateParks();
+			spacious = false;
+			ok = routeOperation(op);
+		}
+		if (!ok && tooLarge) {
+			message = QString("Line %1: routing the %2 takes too much memory on a chip of this size.").arg(op.line).arg(operationNames[op.type]);
+			return false;
+		}
+		if (!ok) {
+			message = QString("Line %1: cannot find a conflict-free route for the %2.").arg(op.line).arg(operationNames[op.type]);
+			return false;
+		}
+	}
+
+	std::stable_sort(plan.commands.begin(), plan.commands.end(), [](const QPair<qint32, QString> &a, const QPair<qint32, QString> &b) -> bool { return a.first < b.first; });
+	for (qint32 i = 0; i < plan.commands.size(); ++i) {
+		commands.push_back(plan.commands[i].second);
+	}
+
+	elapsed = timer.elapsed();
+	return true;
+}
+
+qint32 AssayRouter::makespan() const {
+	return finish;
+}
+
+qint64 AssayRouter::planningTime() const {
+	return elapsed;
+}
+
+qint32 AssayRouter::crossings() const {
+	return plan.crossings;
+}
+
+bool AssayRouter::routeOperation(const AssayOperation &op) {
+	switch (op.type) {
+		case OutputOperation:
+			return routeOutput(op);
+		case MergeOperation:
+			return routeMerge(op);
+		case MixOperation:
+			return routeMix(op);
+		case SplitOperation:
+			return routeSplit(op);
+		default:
+			return false;
+	}
+}
+
+bool AssayRouter::routeOutput(const AssayOperation &op) {
+	qint32 agent = agentOf[op.consumes[0]];
+	park(agent, false);
+
+	QVector<qint32> targets = op.x >= 0 ? QVector<qint32>({op.x * rows + op.y}) : outputs;
+	auto atPort = [&](qint32 cell, qint32 t) -> bool {
+		return targets.contains(cell) && !busy(t + 1, cell); // the droplet is still there while others move
+	};
+	QVector<qint32> path;
+	if (!search(agent, distances(targets), atPort, path)) {
+		return false;
+	}
+	commit(agent, path);
+
+	const Agent &d = plan.agents[agent];
+	reserve(d.ready, d.cell);
+	addCommand(d.ready, "Output", QVector<qint32>({d.cell}));
+	finish = std::max(finish, d.ready + 1);
+	return true;
+}
+
+bool AssayRouter::routeMerge(const AssayOperation &op) {
+	qint32 a = agentOf[op.consumes[0]], b = agentOf[op.consumes[1]];
+	plan.agents[a].parked = plan.agents[b].parked = false;
+	updateParks();
+
+	// Candidate spots: the two droplets end two cells apart in a row, and are merged into the cell between them
+	struct Spot {
+		qint32 estimate, first, second; // first is the spot of a, second the spot of b
+	};
+	QVector<Spot> spots;
+	for (qint32 x = 0; x < columns; ++x) {
+		for (qint32 y = 0; y < rows; ++y) {
+			for (qint32 k = 0; k < 2; ++k) {
+				qint32 dx = k, dy = 1 - k;
+				if (x - dx < 0 || x + dx >= columns || y - dy < 0 || y + dy >= rows) continue;
+				qint32 p = (x - dx) * rows + y - dy, q = (x + dx) * rows + y + dy;
+				if (parkFrom[p] != never || parkFrom[q] != never) continue; // taken by a waiting droplet
+				if (!roomy((p + q) / 2)) continue;
+				spots.push_back({std::max(estimate(a, p), estimate(b, q)), p, q});
+				spots.push_back({std::max(estimate(a, q), estimate(b, p)), q, p});
+			}
+		}
+	}
+	std::stable_sort(spots.begin(), spots.end(), [](const Spot &u, const Spot &v) -> bool { return u.estimate < v.estimate; });
+
+	auto covers = [&](qint32 agent, qint32 cell) -> bool {
+		qint32 c = plan.agents[agent].cell;
+		return c >= 0 && abs(c / rows - cell / rows) <= 1 && abs(c % rows - cell % rows) <= 1;
+	};
+
+	for (qint32 i = 0, tries = 0; i < spots.size() && tries < mergeTries; ++i) {
+		// Route first the droplet whose spot is not covered by the other one, which waits meanwhile
+		qint32 order[2] = {a, b}, spot[2] = {spots[i].first, spots[i].second};
+		if (covers(b, spot[0])) {
+			std::swap(order[0], order[1]);
+			std::swap(spot[0], spot[1]);
+		}
+		if (covers(order[1], spot[0])) continue;
+		++tries;
+
+		Plan saved = plan;
+		bool ok = true;
+		QVector<qint32> path;
+		for (qint32 j = 0; j < 2 && ok; ++j) {
+			park(order[1], j == 0);
+			qint32 target = spot[j];
+			auto hold = [&](qint32 cell, qint32 t) -> bool {
+				return cell == target && holdable(cell, t);
+			};
+			ok = search(order[j], distances(QVector<qint32>({target})), hold, path);
+			if (ok) {
+				commit(order[j], path);
+				park(order[j], true);
+			}
+		}
+		if (!ok) {
+			plan = saved;
+			updateParks();
+			continue;
+		}
+
+		// Both droplets wait on their spots until the later one arrives
+		qint32 t = std::max(plan.agents[a].ready, plan.agents[b].ready);
+		for (qint32 j = 0; j < 2; ++j) {
+			for (qint32 u = plan.agents[order[j]].ready; u <= t + 1; ++u) {
+				reserve(u, spot[j]);
+			}
+			plan.agents[order[j]].parked = false;
+		}
+		qint32 middle = (spot[0] + spot[1]) / 2;
+		reserve(t, middle);
+		reserve(t + 1, middle);
+		addCommand(t, "Merge", QVector<qint32>({spots[i].first, spots[i].second}));
+
+		Agent merged;
+		merged.cell = middle;
+		merged.ready = t + 2;
+		merged.parked = true;
+		agentOf[op.produces[0]] = plan.agents.size();
+		qint32 rootA = lineageOf(a), rootB = lineageOf(b);
+		plan.lineage[rootA] = plan.lineage[rootB] = plan.agents.size();
+		plan.lineage.push_back(plan.agents.size());
+		plan.agents.push_back(merged);
+		visit(plan.agents.size() - 1, middle);
+		updateParks();
+		finish = std::max(finish, merged.ready);
+		return true;
+	}
+	return false;
+}
+
+bool AssayRouter::routeMix(const AssayOperation &op) {
+	qint32 agent = agentOf[op.consumes[0]];
+	park(agent, false);
+
+	// Mix by going round a 2x2 square next to the cell, the one whose visited cells are the fewest stained by other droplets
+	QVector<qint32> loop;
+	auto mixable = [&](qint32 cell, qint32 t) -> bool {
+		qint32 x = cell / rows, y = cell % rows, fewest = never;
+		for (qint32 k = 0; k < 4; ++k) {
+			qint32 dx = k & 1 ? 1 : -1, dy = k & 2 ? 1 : -1;
+			if (x + dx < 0 || x + dx >= columns || y + dy < 0 || y + dy >= rows) continue;
+			qint32 square[4] = {cell, (x + dx) * rows + y, (x + dx) * rows + y + dy, x * rows + y + dy};
+			QVector<qint32> cells({cell});
+			bool ok = true;
+			for (qint32 i = 1; i <= op.steps && ok; ++i) {
+				cells.push_back(square[i % 4]);
+				ok = !conflicts(t + i, cells[i - 1], cells[i]);
+			}
+			if (!ok || !holdable(cells.back(), t + op.steps) || !roomy(cells.back())) continue;
+			qint32 stains = 0;
+			for (qint32 i = 1; i < std::min(op.steps + 1, 4); ++i) {
+				stains += stained(square[i], agent);
+			}
+			if (stains < fewest) {
+				fewest = stains;
+				loop = cells;
+			}
+		}
+		return fewest != never;
+	};
+	QVector<qint32> path;
+	if (!search(agent, QVector<qint32>(rows * columns, 0), mixable, path)) {
+		return false;
+	}
+	commit(agent, path);
+
+	// The mixed droplet goes on as the same agent
+	Agent &d = plan.agents[agent];
+	for (qint32 i = 0; i < op.steps; ++i) {
+		reserve(d.ready + i, loop[i]);
+		visit(agent, loop[i + 1]);
+	}
+	addCommand(d.ready, "Mix", loop);
+	d.cell = loop.back();
+	d.ready += op.steps;
+	agentOf[op.produces[0]] = agent;
+	park(agent, true);
+	finish = std::max(finish, d.ready);
+	return true;
+}
+
+bool AssayRouter::routeSplit(const AssayOperation &op) {
+	qint32 agent = agentOf[op.consumes[0]];
+	park(agent, false);
+
+	// Split where the two cells on either side can be held by the new droplets
+	qint32 first = -1, second = -1;
+	auto splittable = [&](qint32 cell, qint32 t) -> bool {
+		qint32 x = cell / rows, y = cell % rows;
+		for (qint32 k = 0; k < 2; ++k) {
+			qint32 dx = k, dy = 1 - k;
+			if (x - dx < 0 || x + dx >= columns || y - dy < 0 || y + dy >= rows) continue;
+			first = (x - dx) * rows + y - dy;
+			second = (x + dx) * rows + y + dy;
+			if (holdable(first, t) && holdable(second, t) && roomy(first) && roomy(second)) {
+				return true;
+			}
+		}
+		return false;
+	};
+	QVector<qint32> path;
+	if (!search(agent, QVector<qint32>(rows * columns, 0), splittable, path)) {
+		return false;
+	}
+	commit(agent, path);
+
+	qint32 t = plan.agents[agent].ready, cell = plan.agents[agent].cell;
+	for (qint32 u = t; u <= t + 1; ++u) {
+		reserve(u, cell);
+		reserve(u, first);
+		reserve(u, second);
+	}
+	addCommand(t, "Split", QVector<qint32>({cell, first, second}));
+
+	plan.agents[agent].parked = false;
+	for (qint32 j = 0; j < 2; ++j) {
+		Agent part;
+		part.cell = j == 0 ? first : second;
+		part.ready = t + 2;
+		part.parked = true;
+		agentOf[op.produces[j]] = plan.agents.size();
+		plan.lineage.push_back(lineageOf(agent));
+		plan.agents.push_back(part);
+		visit(plan.agents.size() - 1, part.cell);
+	}
+	updateParks();
+	finish = std::max(finish, t + 2);
+	return true;
+}
+
+bool AssayRouter::search(qint32 agent, const QVector<qint32> &heuristic, const Goal &goal, QVector<qint32> &path) {
+	// States are (cell, second), cell -1 being outside the chip before the droplet is dispensed.
+	// A dispensed droplet stays a second on the input port, so that its Input and first Move are at different seconds.
+	const Agent &d = plan.agents[agent];
+	qint32 cells = rows * columns;
+	qint32 start = d.ready;
+
+	// After all reservations and parks have begun nothing changes any more, so later seconds share their states
+	qint32 still = std::max(start, qint32(plan.reserved.size()));
+	for (qint32 i = 0; i < plan.agents.size(); ++i) {
+		if (plan.agents[i].parked) {
+			still = std::max(still, plan.agents[i].ready);
+		}
+	}
+	still += 2;
+
+	// States are indexed by qint32, and a large chip runs out of memory long before that
+	qint64 states = qint64(still - start + 1) * (cells + 1);
+	if (states > maxSearchStates) {
+		tooLarge = true;
+		return false;
+	}
+
+	qint32 entry = never;
+	for (qint32 i = 0; i < d.ports.size(); ++i) {
+		entry = std::min(entry, heuristic[d.ports[i]] + 2);
+	}
+	auto encode = [&](qint32 cell, qint32 t) -> qint32 {
+		return (std::min(t, still) - start) * (cells + 1) + cell + 1;
+	};
+
+	// The cost of a path is its arrival second plus the weight of every stained cell it enters
+	typedef std::tuple<qint32, qint32, qint32> Entry; // (estimated cost, -second, state): ties go deeper first
+	std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> open;
+	QVector<qint32> parent(qint32(states), -2), second(parent.size()), cost(parent.size(), never);
+	QVector<bool> closed(parent.size(), false);
+	auto push = [&](qint32 cell, qint32 t, qint32 from, qint32 g) {
+		qint32 state = encode(cell, t);
+		if (cost[state] <= g) return;
+		cost[state] = g;
+		parent[state] = from;
+		second[state] = t;
+		open.push(Entry(g + (cell >= 0 ? heuristic[cell] : entry), -t, state));
+	};
+	auto penalty = [&](qint32 from, qint32 to) -> qint32 {
+		return to != from && stained(to, agent) ? contaminationWeight : 0;
+	};
+
+	push(d.cell, start, -1, start);
+	while (!open.empty()) {
+		qint32 state = std::get<2>(open.top());
+		open.pop();
+		if (closed[state]) continue;
+		closed[state] = true;
+		qint32 t = second[state], g = cost[state], cell = state % (cells + 1) - 1;
+
+		if (cell >= 0 && goal(cell, t)) {
+			QVector<qint32> states;
+			for (qint32 s = state; s >= 0; s = parent[s]) {
+				states.push_back(s);
+			}
+			path.clear();
+			for (qint32 i = states.size() - 1; i >= 0; --i) {
+				while (start + path.size() <= second[states[i]]) {
+					path.push_back(states[i] % (cells + 1) - 1); // also fills the second spent on the input port
+				}
+			}
+			return true;
+		}
+
+		if (cell < 0) {
+			push(-1, t + 1, state, g + 1);
+			for (qint32 i = 0; i < d.ports.size(); ++i) {
+				qint32 port = d.ports[i];
+				if (!conflicts(t + 1, -1, port) && !conflicts(t + 2, port, port)) {
+					push(port, t + 2, state, g + 2 + penalty(-1, port));
+				}
+			}
+		} else {
+			qint32 x = cell / rows, y = cell % rows;
+			for (qint32 k = -1; k < 4; ++k) {
+				qint32 xx = k < 0 ? x : x + dirX[k], yy = k < 0 ? y : y + dirY[k];
+				if (xx < 0 || xx >= columns || yy < 0 || yy >= rows) continue;
+				qint32 next = xx * rows + yy;
+				if (!conflicts(t + 1, cell, next)) {
+					push(next, t + 1, state, g + 1 + penalty(cell, next));
+				}
+			}
+		}
+	}
+	return false;
+}
+
+void AssayRouter::commit(qint32 agent, const QVector<qint32> &path) {
+	// The last cell is left unreserved: a waiting droplet is kept by its park, and is reserved from its ready second
+	// by the next operation. Reservations of its own would otherwise block the droplet itself.
+	Agent &d = plan.agents[agent];
+	for (qint32 i = 0; i < path.size(); ++i) {
+		qint32 t = d.ready + i;
+		if (i + 1 < path.size()) {
+			reserve(t, path[i]);
+		}
+		if (i == 0) continue;
+		if (path[i - 1] < 0 && path[i] >= 0) {
+			addCommand(t, "Input", QVector<qint32>({path[i]}));
+			visit(agent, path[i]);
+		} else if (path[i - 1] >= 0 && path[i - 1] != path[i]) {
+			addCommand(t - 1, "Move", QVector<qint32>({path[i - 1], path[i]}));
+			visit(agent, path[i]);
+		}
+	}
+	d.cell = path.back();
+	d.ready += path.size() - 1;
+	d.ports.clear();
+	finish = std::max(finish, d.ready);
+}
+
+void AssayRouter::park(qint32 agent, bool parked) {
+	plan.agents[agent].parked = parked;
+	updateParks();
+}
+
+void AssayRouter::updateParks() {
+	parkFrom.fill(never, rows * columns);
+	crowded.fill(false, rows * columns);
+	for (qint32 i = 0; i < plan.agents.size(); ++i) {
+		const Agent &d = plan.agents[i];
+		if (!d.parked || d.cell < 0) continue;
+		qint32 x = d.cell / rows, y = d.cell % rows;
+		for (qint32 xx = std::max(x - 3, 0); xx <= std::min(x + 3, columns - 1); ++xx) {
+			for (qint32 yy = std::max(y - 3, 0); yy <= std::min(y + 3, rows - 1); ++yy) {
+				crowded[xx * rows + yy] = true;
+			}
+		}
+		for (qint32 xx = std::max(x - 1, 0); xx <= std::min(x + 1, columns - 1); ++xx) {
+			for (qint32 yy = std::max(y - 1, 0); yy <= std::min(y + 1, rows - 1); ++yy) {
+				parkFrom[xx * rows + yy] = std::min(parkFrom[xx * rows + yy], d.ready);
+			}
+		}
+	}
+}
+
+QVector<qint32> AssayRouter::distances(const QVector<qint32> &targets) const {
+	QVector<qint32> dist(rows * columns, -1);
+	QVector<qint32> queue;
+	queue.reserve(rows * columns);
+	for (qint32 i = 0; i < targets.size(); ++i) {
+		queue.push_back(targets[i]);
+		dist[targets[i]] = 0;
+	}
+	for (qint32 head = 0; head < queue.size(); ++head) {
+		qint32 cur = queue[head], x = cur / rows, y = cur % rows;
+		for (qint32 k = 0; k < 4; ++k) {
+			qint32 xx = x + dirX[k], yy = y + dirY[k];
+			if (xx < 0 || xx >= columns || yy < 0 || yy >= rows) continue;
+			qint32 next = xx * rows + yy;
+			if (dist[next] < 0) {
+				dist[next] = dist[cur] + 1;
+				queue.push_back(next);
+			}
+		}
+	}
+	return dist;
+}
+
+qint32 AssayRouter::estimate(qint32 agent, qint32 cell) const {
+	// Earliest arrival ignoring the other droplets
+	const Agent &d = plan.agents[agent];
+	auto manhattan = [&](qint32 u) -> qint32 {
+		return abs(u / rows - cell / rows) + abs(u % rows - cell % rows);
+	};
+	if (d.cell >= 0) {
+		return d.ready + manhattan(d.cell);
+	}
+	qint32 best = never;
+	for (qint32 i = 0; i < d.ports.size(); ++i) {
+		best = std::min(best, manhattan(d.ports[i]));
+	}
+	return d.ready + 2 + best;
+}
+
+void AssayRouter::reserve(qint32 t, qint32 cell) {
+	if (t < 0 || cell < 0) return; // outside the chip
+	if (t >= plan.reserved.size()) {
+		plan.reserved.resize(t + 1);
+	}
+	if (plan.reserved[t].isNull()) {
+		plan.reserved[t] = CellMask(rows, columns);
+	}
+	qint32 x = cell / rows, y = cell % rows;
+	plan.reserved[t].setRect(x - 1, y - 1, x + 1, y + 1);
+	for (qint32 xx = std::max(x - 1, 0); xx <= std::min(x + 1, columns - 1); ++xx) {
+		for (qint32 yy = std::max(y - 1, 0); yy <= std::min(y + 1, rows - 1); ++yy) {
+			plan.lastBusy[xx * rows + yy] = std::max(plan.lastBusy[xx * rows + yy], t);
+		}
+	}
+}
+
+bool AssayRouter::busy(qint32 t, qint32 cell) const {
+	if (t < 0 || cell < 0) return false;
+	if (parkFrom[cell] <= t) return true;
+	return t < plan.reserved.size() && !plan.reserved[t].isNull() && plan.reserved[t].test(cell / rows, cell % rows);
+}
+
+bool AssayRouter::conflicts(qint32 t, qint32 from, qint32 to) const {
+	// Moving from (from, t - 1) to (to, t) must keep the distance constraints against every other droplet
+	return busy(t, to) || busy(t - 1, to) || busy(t, from);
+}
+
+bool AssayRouter::holdable(qint32 cell, qint32 t) const {
+	// A droplet may stay on the cell from second t on
+	return plan.lastBusy[cell] < t && parkFrom[cell] == never;
+}
+
+bool AssayRouter::roomy(qint32 cell) const {
+	return !spacious || (!nearPort[cell] && !crowded[cell]);
+}
+
+qint32 AssayRouter::lineageOf(qint32 agent) const {
+	while (plan.lineage[agent] != agent) {
+		agent = plan.lineage[agent];
+	}
+	return agent;
+}
+
+bool AssayRouter::stained(qint32 cell, qint32 agent) const {
+	// Residue of another lineage, whether it passes before or after: either way the cell needs a wash in between
+	qint32 r = plan.residue[cell];
+	return r == -2 || (r != -1 && lineageOf(r) != lineageOf(agent));
+}
+
+void AssayRouter::visit(qint32 agent, qint32 cell) {
+	if (stained(cell, agent)) {
+		++plan.crossings;
+		plan.residue[cell] = -2;
+	} else {
+		plan.residue[cell] = agent;
+	}
+}
+
+void AssayRouter::addCommand(qint32 t, const QString &name, const QVector<qint32> &cells) {
+	QString text = QString("%1 %2").arg(name).arg(t);
+	for (qint32 i = 0; i < cells.size(); ++i) {
+		text += QString(",%1,%2").arg(cells[i] / rows + 1).arg(rows - cells[i] % rows);
+	}
+	plan.commands.push_back(qMakePair(t, text + ";"));
+}
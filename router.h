@@ -0,0 +1,106 @@
+#ifndef ROUTER_H
+#define ROUTER_H
+
+#include <functional>
+
+#include <QMap>
+#include <QPair>
+#include <QString>
+#include <QVector>
+#include <QStringList>
+
+#include "utility.h"
+
+// Synthesizes a command file from a high-level assay. Each operation names the droplets it consumes and
+// produces, which gives the dependency edges between operations:
+//   Input a [x, y];  Output a [x, y];  Merge c, a, b;  Mix b, a, steps;  Split b, c, a;
+// Operations are scheduled as soon as their droplets exist. Droplet paths are planned one at a time by
+// space-time A* against a reservation table of the paths planned before (prioritized planning), keeping
+// the static and dynamic distance constraints checked by loadFile. A path costs its seconds plus a weight for
+// every cell it enters on which a droplet of another lineage leaves residue, trading path length for fewer cells
+// to wash. The products of a merge or a split share the lineage of the droplets they come from.
+
+enum AssayOperationType {
+	InputOperation, OutputOperation, MergeOperation, MixOperation, SplitOperation
+};
+
+struct AssayOperation {
+	AssayOperationType type;
+	qint32 line;
+	QStringList consumes, produces;
+	qint32 x, y; // port cell of Input and Output, -1 for any port
+	qint32 steps; // steps of Mix
+};
+
+bool loadAssay(const QString &url, const ChipConfig &config, QVector<AssayOperation> &assay, QString &message);
+
+class AssayRouter {
+public:
+	explicit AssayRouter(qint32 contaminationWeight = 1);
+
+	// On success commands holds the lines of a command file, sorted by time
+	bool route(const ChipConfig &config, const QVector<AssayOperation> &assay, QStringList &commands, QString &message);
+
+	qint32 makespan() const;
+	qint64 planningTime() const; // in milliseconds
+	qint32 crossings() const; // cells entered by a droplet after or before another one
+
+private:
+	struct Agent {
+		qint32 cell; // -1 before the droplet is dispensed
+		qint32 ready; // second from which the droplet waits at cell
+		bool parked; // waiting on the chip until its next operation
+		QVector<qint32> ports; // input port cells, before the droplet is dispensed
+	};
+
+	// Mutable state of the routing, saved and restored when a try fails
+	struct Plan {
+		QVector<CellMask> reserved; // reserved[t]: cells within distance 1 of some droplet at second t
+		QVector<qint32> lastBusy; // last second a cell is reserved
+		QVector<Agent> agents;
+		QVector<QPair<qint32, QString>> commands;
+		QVector<qint32> residue; // droplet leaving residue on a cell, -1 for none and -2 for several lineages
+		QVector<qint32> lineage; // agent -> an agent of the same lineage, or itself for the root of the lineage
+		qint32 crossings;
+	};
+
+	typedef std::function<bool(qint32, qint32)> Goal; // (cell, second) -> whether the path may end there
+
+	bool routeOperation(const AssayOperation &op);
+	bool routeOutput(const AssayOperation &op);
+	bool routeMerge(const AssayOperation &op);
+	bool routeMix(const AssayOperation &op);
+	bool routeSplit(const AssayOperation &op);
+
+	bool search(qint32 agent, const QVector<qint32> &heuristic, const Goal &goal, QVector<qint32> &path);
+	void commit(qint32 agent, const QVector<qint32> &path);
+	void park(qint32 agent, bool parked);
+	void updateParks();
+	QVector<qint32> distances(const QVector<qint32> &targets) const;
+	qint32 estimate(qint32 agent, qint32 cell) const;
+	void reserve(qint32 t, qint32 cell);
+	bool busy(qint32 t, qint32 cell) const;
+	bool conflicts(qint32 t, qint32 from, qint32 to) const;
+	bool holdable(qint32 cell, qint32 t) const;
+	bool roomy(qint32 cell) const;
+	qint32 lineageOf(qint32 agent) const;
+	bool stained(qint32 cell, qint32 agent) const;
+	void visit(qint32 agent, qint32 cell);
+	void addCommand(qint32 t, const QString &name, const QVector<qint32> &cells);
+
+	qint32 contaminationWeight; // seconds a path may spend to avoid entering a cell stained by another droplet
+
+	qint32 rows, columns;
+	QVector<qint32> inputs, outputs; // cells of the input and output ports
+	QVector<bool> nearPort; // cells within distance 1 of a port
+	bool spacious; // keep waiting droplets off the ports and apart from each other
+	QMap<QString, qint32> agentOf; // droplet name -> agent
+	Plan plan;
+	QVector<qint32> parkFrom; // earliest second a parked droplet is within distance 1 of a cell
+	QVector<bool> crowded; // cells within distance 3 of a parked droplet, too close to leave a lane between
+	qint32 finish;
+	qint64 elapsed;
+	bool tooLarge; // a search failed for having more states than maxSearchStates
+};
+
+#endif // ROUTER_H
@@ -0,0 +1,238 @@
+#include "soundmixer.h"
+
+#include <QFile>
+#include <QDebug>
+#include <QMutexLocker>
+#include <QtEndian>
+#include <QAudioDeviceInfo>
+
+static const qint32 mixRate = 44100;
+static const qint32 mixChannels = 2;
+static const qint32 frameBytes = mixChannels * qint32(sizeof(qint16));
+static const qint32 deviceLatency = 40; // in milliseconds
+static const qint32 nullSinkInterval = 20; // in milliseconds
+
+AudioSink::AudioSink(QObject *parent) : QObject(parent) {}
+
+DeviceAudioSink::DeviceAudioSink(QObject *parent) : AudioSink(parent), output(nullptr) {}
+
+void DeviceAudioSink::start(QIODevice *device) {
+	QAudioFormat format = SoundMixer::mixFormat();
+	QAudioDeviceInfo info = QAudioDeviceInfo::defaultOutputDevice();
+	if (info.isNull() || !info.isFormatSupported(format)) {
+		qWarning() << "Audio output device does not support the mixer format, sound is disabled";
+		return;
+	}
+	output = new QAudioOutput(info, format, this);
+	output->setBufferSize(mixRate * frameBytes * deviceLatency / 1000);
+	output->start(device);
+}
+
+void DeviceAudioSink::stop() {
+	if (output != nullptr) {
+		output->stop();
+	}
+}
+
+NullAudioSink::NullAudioSink(QObject *parent) : AudioSink(parent), device(nullptr), timer(nullptr), consumed(0) {}
+
+void NullAudioSink::start(QIODevice *device) {
+	this->device = device;
+	consumed = 0;
+	timer = new QTimer(this);
+	timer->setInterval(nullSinkInterval);
+	connect(timer, SIGNAL(timeout()), this, SLOT(onTimeout()));
+	elapsed.start();
+	timer->start();
+}
+
+void NullAudioSink::stop() {
+	if (timer != nullptr) {
+		timer->stop();
+	}
+}
+
+void NullAudioSink::onTimeout() {
+	qint64 frames = elapsed.elapsed() * mixRate / 1000 - consumed;
+	if (frames <= 0) return;
+
+	QByteArray discard(qint32(frames * frameBytes), Qt::Uninitialized);
+	consumed += device->read(discard.data(), discard.size()) / frameBytes;
+}
+
+SoundMixer::SoundMixer(bool headless, QObject *parent) : QIODevice(parent), clock(0), anchorFrame(0), anchorTime(0), anchorSpeed(1.0) {
+	open(QIODevice::ReadOnly);
+
+	if (headless) {
+		sink = new NullAudioSink;
+	} else {
+		sink = new DeviceAudioSink;
+	}
+	sink->moveToThread(&thread);
+	connect(&thread, SIGNAL(finished()), sink, SLOT(deleteLater()));
+	thread.setObjectName("audio");
+	thread.start(QThread::TimeCriticalPriority);
+
+	QMetaObject::invokeMethod(sink, "start", Qt::QueuedConnection, Q_ARG(QIODevice *, this));
+}
+
+SoundMixer::~SoundMixer() {
+	QMetaObject::invokeMethod(sink, "stop", Qt::BlockingQueuedConnection);
+	thread.quit();
+	thread.wait();
+}
+
+QAudioFormat SoundMixer::mixFormat() {
+	QAudioFormat format;
+	format.setSampleRate(mixRate);
+	format.setChannelCount(mixChannels);
+	format.setSampleSize(16);
+	format.setSampleType(QAudioFormat::SignedInt);
+	format.setByteOrder(QAudioFormat::LittleEndian);
+	format.setCodec("audio/pcm");
+	return format;
+}
+
+bool SoundMixer::loadEffect(qint32 effect, const QString &url) {
+	QFile file(url);
+	if (!file.open(QFile::ReadOnly)) {
+		return false;
+	}
+	QByteArray wav = file.readAll();
+	const uchar *p = reinterpret_cast<const uchar *>(wav.constData());
+
+	if (wav.size() < 12 || wav.left(4) != "RIFF" || wav.mid(8, 4) != "WAVE") {
+		return false;
+	}
+
+	// Walk through the RIFF chunks to find the format and the sample data
+	qint32 format = 0, channels = 0, rate = 0, bits = 0;
+	qint32 dataOffset = -1, dataSize = 0;
+	for (qint32 i = 12; i + 8 <= wav.size(); ) {
+		QByteArray id = wav.mid(i, 4);
+		qint32 size = qint32(qFromLittleEndian<quint32>(p + i + 4));
+		if (id == "fmt " && size >= 16 && i + 24 <= wav.size()) {
+			format = qFromLittleEndian<quint16>(p + i + 8);
+			channels = qFromLittleEndian<quint16>(p + i + 10);
+			rate = qint32(qFromLittleEndian<quint32>(p + i + 12));
+			bits = qFromLittleEndian<quint16>(p + i + 22);
+		} else if (id == "data") {
+			dataOffset = i + 8;
+			dataSize = std::min(size, wav.size() - dataOffset);
+		}
+		i += 8 + size + (size & 1);
+	}
+
+	if (format != 1 || (bits != 8 && bits != 16) || channels < 1 || rate <= 0 || dataOffset < 0) {
+		qWarning() << "Unsupported WAV format:" << url;
+		return false;
+	}
+
+	auto sample = [&](qint32 frame, qint32 channel) -> qint32 {
+		qint32 index = frame * channels + std::min(channel, channels - 1);
+		if (bits == 8) {
+			return (qint32(p[dataOffset + index]) - 128) << 8;
+		} else {
+			return qFromLittleEndian<qint16>(p + dataOffset + index * 2);
+		}
+	};
+
+	// Convert to the mixer format, resampling linearly if needed
+	qint32 frames = dataSize / (channels * bits / 8);
+	qint32 outFrames = qint32(qint64(frames) * mixRate / rate);
+	QVector<qint16> pcm(outFrames * mixChannels);
+	for (qint32 i = 0; i < outFrames; ++i) {
+		qreal src = qreal(i) * rate / mixRate;
+		qint32 f = qint32(src);
+		qreal frac = src - f;
+		qint32 g = std::min(f + 1, frames - 1);
+		for (qint32 c = 0; c < mixChannels; ++c) {
+			pcm[i * mixChannels + c] = qint16(sample(f, c) * (1.0 - frac) + sample(g, c) * frac);
+		}
+	}
+
+	QMutexLocker locker(&mutex);
+	bank[effect] = pcm;
+	return true;
+}
+
+void SoundMixer::sync(qint64 simTime, qreal speed) {
+	QMutexLocker locker(&mutex);
+	anchorFrame = clock;
+	anchorTime = simTime;
+	anchorSpeed = speed;
+}
+
+void SoundMixer::schedule(qint32 effects, qint64 simTime) {
+	QMutexLocker locker(&mutex);
+	qint64 frame = anchorFrame + qint64((simTime - anchorTime) / anchorSpeed * mixRate / 1000.0);
+	addVoices(effects, std::max(frame, clock));
+}
+
+void SoundMixer::play(qint32 effects) {
+	QMutexLocker locker(&mutex);
+	addVoices(effects, clock);
+}
+
+void SoundMixer::cancel() {
+	QMutexLocker locker(&mutex);
+	for (qint32 i = voices.size() - 1; i >= 0; --i) {
+		if (voices[i].start >= clock) {
+			voices.remove(i);
+		}
+	}
+}
+
+void SoundMixer::addVoices(qint32 effects, qint64 frame) {
+	for (auto iter = bank.constBegin(); iter != bank.constEnd(); ++iter) {
+		if (effects & iter.key()) {
+			Voice voice;
+			voice.effect = iter.key();
+			voice.start = frame;
+			voices.push_back(voice);
+		}
+	}
+}
+
+bool SoundMixer::isSequential() const {
+	return true;
+}
+
+qint64 SoundMixer::readData(char *data, qint64 maxSize) {
+	qint32 frames = qint32(maxSize / frameBytes);
+	if (frames <= 0) return 0;
+
+	QMutexLocker locker(&mutex);
+
+	buffer.fill(0, frames * mixChannels);
+	for (qint32 i = voices.size() - 1; i >= 0; --i) {
+		const Voice &voice = voices[i];
+		const QVector<qint16> &pcm = bank[voice.effect];
+		qint64 offset = voice.start - clock; // position of the voice start within this chunk
+		if (offset >= frames) continue;
+
+		qint32 src = qint32(std::max(-offset, qint64(0))) * mixChannels;
+		qint32 dst = qint32(std::max(offset, qint64(0))) * mixChannels;
+		qint32 count = std::min(pcm.size() - src, buffer.size() - dst);
+		for (qint32 k = 0; k < count; ++k) {
+			buffer[dst + k] += pcm[src + k];
+		}
+		if (src + count >= pcm.size()) {
+			voices.remove(i);
+		}
+	}
+
+	qint16 *out = reinterpret_cast<qint16 *>(data);
+	for (qint32 k = 0; k < buffer.size(); ++k) {
+		out[k] = qint16(std::max(-32768, std::min(32767, buffer[k])));
+	}
+	clock += frames;
+
+	return qint64(frames) * frameBytes;
+}
+
+qint64 SoundMixer::writeData(const char *data, qint64 maxSize) {
+	Q_UNUSED(data);
+	Q_UNUSED(maxSize);
+	return -1;
+}
@@ -0,0 +1,113 @@
+#ifndef SOUNDMIXER_H
+#define SOUNDMIXER_H
+
+#include <QMap>
+#include <QMutex>
+#include <QTimer>
+#include <QThread>
+#include <QVector>
+#include <QIODevice>
+#include <QAudioFormat>
+#include <QAudioOutput>
+#include <QElapsedTimer>
+
+// Output stage of the mixer. Sinks live on the audio thread and pull PCM frames from the mixer device.
+class AudioSink : public QObject {
+	Q_OBJECT
+
+public:
+	explicit AudioSink(QObject *parent = nullptr);
+
+public slots:
+	virtual void start(QIODevice *device) = 0;
+	virtual void stop() = 0;
+};
+
+// Plays the mixed stream on the default output device
+class DeviceAudioSink : public AudioSink {
+	Q_OBJECT
+
+public:
+	explicit DeviceAudioSink(QObject *parent = nullptr);
+
+public slots:
+	void start(QIODevice *device);
+	void stop();
+
+private:
+	QAudioOutput *output;
+};
+
+// Consumes the mixed stream in real time without producing any sound, for headless runs
+class NullAudioSink : public AudioSink {
+	Q_OBJECT
+
+public:
+	explicit NullAudioSink(QObject *parent = nullptr);
+
+public slots:
+	void start(QIODevice *device);
+	void stop();
+
+private slots:
+	void onTimeout();
+
+private:
+	QIODevice *device;
+	QTimer *timer;
+	QElapsedTimer elapsed;
+	qint64 consumed; // frames consumed so far
+};
+
+class SoundMixer : public QIODevice {
+	Q_OBJECT
+
+public:
+	explicit SoundMixer(bool headless = false, QObject *parent = nullptr);
+	~SoundMixer();
+
+	static QAudioFormat mixFormat();
+
+	// Decode a WAV file once into the sample bank of the given effect flag
+	bool loadEffect(qint32 effect, const QString &url);
+
+	// Anchor simulation time (in milliseconds) to the current position of the audio clock
+	void sync(qint64 simTime, qreal speed);
+
+	// Start all effects in the bit mask at the given simulation time (in milliseconds)
+	void schedule(qint32 effects, qint64 simTime);
+
+	// Start all effects in the bit mask as soon as possible
+	void play(qint32 effects);
+
+	// Drop scheduled effects which have not started yet
+	void cancel();
+
+	bool isSequential() const;
+
+protected:
+	qint64 readData(char *data, qint64 maxSize);
+	qint64 writeData(const char *data, qint64 maxSize);
+
+private:
+	struct Voice {
+		qint32 effect;
+		qint64 start; // start frame on the mixer clock
+	};
+
+	void addVoices(qint32 effects, qint64 frame);
+
+	QThread thread;
+	AudioSink *sink;
+
+	QMutex mutex;
+	QMap<qint32, QVector<qint16>> bank; // interleaved stereo samples of each effect
+	QVector<Voice> voices;
+	QVector<qint32> buffer;
+	qint64 clock; // frames rendered so far
+
+	qint64 anchorFrame, anchorTime;
+	qreal anchorSpeed;
+};
+
+#endif // SOUNDMIXER_H
@@ -235,7 +235,7 @@ void renderGridAxisNumber(const ChipConfig &config, qreal W, qreal H, QPainter *
 	g->restore();
 }
 
-void renderContaminants(const ChipConfig &config, qreal W, qreal H, quint32 randSeed, const QVector<Droplet> &droplets, const QVector<QVector<QSet<qint32>>> &contaminants, QPainter *g) {
+void renderContaminants(const ChipConfig &config, qreal W, qreal H, quint64 randSeed, const QVector<Droplet> &droplets, const QVector<QVector<QSet<qint32>>> &contaminants, QPainter *g) {
 	if (!config.valid) return;
 
 	qint32 R = config.rows, C = config.columns;
@@ -248,14 +248,14 @@ void renderContaminants(const ChipConfig &config, qreal W, qreal H, quint32 rand
 	g->setPen(Qt::PenStyle::NoPen);
 	for (qint32 x = 0; x < C; ++x) {
 		for (qint32 y = 0; y < R; ++y) {
-			srand(randSeed + quint32(((x + 1) * R + 1) * (y + 1)));
+			Random random(randSeed, streamContaminants + quint64(x * R + y));
 			qint32 contaminated = contaminants[x][y].size();
-			qint32 marks = qint32(ceil(randInt(4, contaminationDots) / qreal(contaminated)));
+			qint32 marks = qint32(ceil(random.randInt(4, contaminationDots) / qreal(contaminated)));
 			for (qint32 cnt = 1; cnt <= marks; ++cnt) {
 				for (auto s: contaminants[x][y]) {
 					auto it = droplets[s][std::min(droplets[s].size() - 1, 1)];
 					g->setBrush(QColor::fromHsv(it.h, it.s, it.v, 0x7f));
-					g->drawEllipse(QPointF((x + randReal(rContaminant * 0.5, 1.0 - rContaminant * 0.5)) * grid, (y + randReal(rContaminant * 0.5, 1.0 - rContaminant * 0.5)) * grid), rContaminant * grid, rContaminant * grid);
+					g->drawEllipse(QPointF((x + random.randReal(rContaminant * 0.5, 1.0 - rContaminant * 0.5)) * grid, (y + random.randReal(rContaminant * 0.5, 1.0 - rContaminant * 0.5)) * grid), rContaminant * grid, rContaminant * grid);
 				}
 			//	g->drawEllipse(QPointF((x + 0.5) * grid, (y + 0.5) * grid), rContaminant * grid, rContaminant * grid);
 			}
@@ -290,7 +290,25 @@ void renderContaminantCount(const ChipConfig &config, qreal W, qreal H, const QV
 	g->restore();
 }
 
-void renderWashObstacles(const ChipConfig &config, qreal W, qreal H, const QVector<QVector<bool>> &obstacles, QPainter *g) {
+void renderContaminantSummary(const ChipConfig &config, qreal W, qreal H, const ContaminationSummary &summary, QPainter *g) {
+	if (!config.valid) return;
+
+	qreal size = getGridSize(W, H, 8, 8) * 0.75;
+
+	QFont font;
+	font.setPointSizeF(std::max(size * 0.4, 4.0));
+	g->setFont(font);
+	g->setPen(Qt::black);
+
+	QString str = QString("Contaminated cells: %1 / Residues: %2 / Max per cell: %3").arg(summary.cells).arg(summary.residues).arg(summary.maxResidues);
+	if (summary.errorTime >= 0) {
+		str += QString(" / Error at %1").arg(summary.errorTime);
+	}
+
+	g->drawText(QRectF(size * 0.25, 0.0, W - size * 0.5, H - size * 0.25), Qt::AlignLeft | Qt::AlignBottom, str);
+}
+
+void renderWashObstacles(const ChipConfig &config, qreal W, qreal H, const CellMask &obstacles, QPainter *g) {
 	if (!config.valid || !config.hasWash) return;
 
 	qint32 R = config.rows, C = config.columns;
@@ -305,7 +323,7 @@ void renderWashObstacles(const ChipConfig &config, qreal W, qreal H, const QVect
 	g->setBrush(halfGrey);
 	for (qint32 x = 0; x < C; ++x) {
 		for (qint32 y = 0; y < R; ++y) {
-			if (obstacles[x][y]) {
+			if (obstacles.test(x, y)) {
 			//	g->drawLine(QPointF(x * grid, y * grid), QPointF((x + 1) * grid, (y + 1) * grid));
 			//	g->drawLine(QPointF(x * grid, (y + 1) * grid), QPointF((x + 1) * grid, y * grid));
 				g->drawRect(QRectF(x * grid, y * grid, grid, grid));
@@ -358,3 +376,35 @@ void renderWash(const ChipConfig &config, qreal W, qreal H, qreal time, const QV
 
 	g->restore();
 }
+
+void renderProfile(const Profiler &profiler, qreal budget, qreal W, qreal H, QPainter *g) {
+	// Mean and peak time of every stage over the last frames, and the share of the frame budget (in milliseconds) in use
+	qreal size = getGridSize(W, H, 8, 8) * 0.75;
+
+	QStringList lines;
+	for (qint32 s = 0; s < ProfileStageCount; ++s) {
+		ProfileStage stage = ProfileStage(s);
+		lines.push_back(QString("%1: %2 / %3 ms").arg(Profiler::name(stage)).arg(profiler.mean(stage), 0, 'f', 2).arg(profiler.peak(stage), 0, 'f', 2));
+	}
+	qreal work = profiler.mean(StageFrame) + profiler.mean(StageSounds) + profiler.mean(StageContamination);
+	lines.push_back(QString("Budget: %1 of %2 ms (%3%)").arg(work, 0, 'f', 2).arg(budget, 0, 'f', 0).arg(work / budget * 100.0, 0, 'f', 0));
+	qreal interval = profiler.frameInterval();
+	if (interval > 0) {
+		lines.push_back(QString("Interval: %1 ms (%2 fps)").arg(interval, 0, 'f', 1).arg(1000.0 / interval, 0, 'f', 0));
+	}
+
+	g->save();
+
+	QFont font;
+	font.setPointSizeF(std::max(size * 0.3, 4.0));
+	g->setFont(font);
+	QRectF box = g->boundingRect(QRectF(0.0, 0.0, W, H), Qt::AlignLeft | Qt::AlignTop, lines.join('\n')).adjusted(-size * 0.2, -size * 0.2, size * 0.2, size * 0.2);
+	box.moveTopLeft(QPointF(size * 0.25, size * 0.25));
+	g->setPen(Qt::PenStyle::NoPen);
+	g->setBrush(halfGrey);
+	g->drawRect(box);
+	g->setPen(Qt::black);
+	g->drawText(box.adjusted(size * 0.2, size * 0.2, -size * 0.2, -size * 0.2), Qt::AlignLeft | Qt::AlignTop, lines.join('\n'));
+
+	g->restore();
+}
@@ -10,14 +10,20 @@
 const qreal eps = 1e-8;
 const qreal inf = 1e100;
 
+const qint32 maxChipSize = 1024;
+
 const qreal radius = 0.4;
 const qreal rContaminant = 0.2;
 const qint32 contaminationDots = 10;
 
 const qreal runAcceleration = 1.0;
 const qreal washAcceleration = runAcceleration * 8.0;
+const qint32 maxWashDroplets = 16;
+
+const qint32 ticksPerSecond = 10;
 
 const qreal soundOffset = 0.3;
+const qint32 soundLookahead = 100;
 const qreal mergingTimeInterval = 1.6;
 const qreal splitStretchInterval = 1.2;
 
@@ -25,6 +31,11 @@ const qint32 sndFxMove = 1;
 const qint32 sndFxMerge = 2;
 const qint32 sndFxSplitting = 4;
 const qint32 sndFxSplit = 8;
+const qint32 sndFxError = 16;
+
+const quint64 streamDroplets = 0;
+const quint64 streamWash = 1;
+const quint64 streamContaminants = 2;
 
 const qint32 dirX[8] = {-1, 0, 0, 1, -1, -1, 1, 1};
 const qint32 dirY[8] = {0, 1, -1, 0, -1, 1, -1, 1};
@@ -36,7 +47,7 @@ const QColor halfSaturatedPurple = QColor::fromHsv(270, 127, 255, 127);
 const QColor halfGrey = QColor::fromRgb(192, 192, 192, 192);
 
 void ChipConfig::init(qint32 rows, qint32 columns) {
-	if (rows < 3 || rows > 12 || columns < 3 || columns > 12 || (rows == 3 && columns == 3)) {
+	if (rows < 3 || rows > maxChipSize || columns < 3 || columns > maxChipSize || (rows == 3 && columns == 3)) {
 		valid = false;
 		return;
 	} else {
@@ -65,6 +76,371 @@ Command::Command(CommandType type, qint32 t, qint32 x1, qint32 y1, qint32 x2, qi
 
 ErrorLog::ErrorLog(qint32 t, QString msg) : t(t), msg(msg) {}
 
+ContaminationSummary::ContaminationSummary() : cells(0), residues(0), maxResidues(0), errorTime(-2) {}
+
+CellMask::CellMask(qint32 rows, qint32 columns) : R(std::max(rows, 0)), C(std::max(columns, 0)), stride((R + 63) / 64), words(C * stride, 0) {}
+
+qint32 CellMask::rows() const {
+	return R;
+}
+
+qint32 CellMask::columns() const {
+	return C;
+}
+
+bool CellMask::isNull() const {
+	return words.empty();
+}
+
+bool CellMask::test(qint32 x, qint32 y) const {
+	return (words[x * stride + (y >> 6)] >> (y & 63)) & 1;
+}
+
+void CellMask::set(qint32 x, qint32 y, bool value) {
+	quint64 bit = quint64(1) << (y & 63);
+	if (value) {
+		words[x * stride + (y >> 6)] |= bit;
+	} else {
+		words[x * stride + (y >> 6)] &= ~bit;
+	}
+}
+
+void CellMask::setRect(qint32 x0, qint32 y0, qint32 x1, qint32 y1) {
+	x0 = std::max(x0, 0);
+	y0 = std::max(y0, 0);
+	x1 = std::min(x1, C - 1);
+	y1 = std::min(y1, R - 1);
+	if (x0 > x1 || y0 > y1) return;
+
+	for (qint32 w = y0 >> 6; w <= y1 >> 6; ++w) {
+		// Bits [lo, hi] of this word
+		qint32 lo = std::max(y0 - w * 64, 0), hi = std::min(y1 - w * 64, 63);
+		quint64 bits = (hi == 63 ? ~quint64(0) : (quint64(1) << (hi + 1)) - 1) & ~((quint64(1) << lo) - 1);
+		for (qint32 x = x0; x <= x1; ++x) {
+			words[x * stride + w] |= bits;
+		}
+	}
+}
+
+CellMask CellMask::dilated() const {
+	// Vertical pass by shifting the words of each column, then horizontal pass by OR-ing neighbouring columns
+	CellMask vertical(R, C), result(R, C);
+	quint64 last = (R & 63) ? (quint64(1) << (R & 63)) - 1 : ~quint64(0); // valid bits of the last word
+	for (qint32 x = 0; x < C; ++x) {
+		const quint64 *col = words.constData() + x * stride;
+		for (qint32 w = 0; w < stride; ++w) {
+			quint64 up = (col[w] >> 1) | (w + 1 < stride ? col[w + 1] << 63 : 0);
+			quint64 down = (col[w] << 1) | (w > 0 ? col[w - 1] >> 63 : 0);
+			vertical.words[x * stride + w] = (col[w] | up | down) & (w + 1 < stride ? ~quint64(0) : last);
+		}
+	}
+	for (qint32 x = 0; x < C; ++x) {
+		for (qint32 w = 0; w < stride; ++w) {
+			quint64 bits = vertical.words[x * stride + w];
+			if (x > 0) bits |= vertical.words[(x - 1) * stride + w];
+			if (x + 1 < C) bits |= vertical.words[(x + 1) * stride + w];
+			result.words[x * stride + w] = bits;
+		}
+	}
+	return result;
+}
+
+CellMask &CellMask::operator|=(const CellMask &other) {
+	for (qint32 i = 0; i < words.size(); ++i) {
+		words[i] |= other.words[i];
+	}
+	return *this;
+}
+
+bool CellMask::operator==(const CellMask &other) const {
+	return R == other.R && C == other.C && words == other.words;
+}
+
+bool CellMask::operator!=(const CellMask &other) const {
+	return !(*this == other);
+}
+
+QByteArray CellMask::toByteArray() const {
+	return QByteArray(reinterpret_cast<const char *>(words.constData()), words.size() * qint32(sizeof(quint64)));
+}
+
+OccupancyIndex::OccupancyIndex() : R(0), C(0), last(0) {}
+
+void OccupancyIndex::build(const ChipConfig &config, const QVector<Droplet> &droplets) {
+	R = config.rows;
+	C = config.columns;
+	last = 0;
+
+	Intervals covered(R * C), nearby(R * C);
+	for (qint32 i = 0; i < droplets.size(); ++i) {
+		for (qint32 k = 1; k < droplets[i].size(); ++k) {
+			qint32 t0 = qint32(floor(droplets[i][k - 1].t)), t1 = qint32(ceil(droplets[i][k].t));
+			for (qint32 j = k - 1; j <= k; ++j) {
+				const DropletStatus &s = droplets[i][j];
+				qint32 x0 = std::max(qint32(ceil(s.x - s.rx)), 0), x1 = std::min(qint32(floor(s.x + s.rx)), C - 1);
+				qint32 y0 = std::max(qint32(ceil(s.y - s.ry)), 0), y1 = std::min(qint32(floor(s.y + s.ry)), R - 1);
+				if (x0 > x1 || y0 > y1) continue; // outside the chip
+				for (qint32 x = x0; x <= x1; ++x) {
+					for (qint32 y = y0; y <= y1; ++y) {
+						covered[x * R + y].push_back(Position(t0, t1));
+					}
+				}
+				for (qint32 x = std::max(x0 - 1, 0); x <= std::min(x1 + 1, C - 1); ++x) {
+					for (qint32 y = std::max(y0 - 1, 0); y <= std::min(y1 + 1, R - 1); ++y) {
+						nearby[x * R + y].push_back(Position(t0, t1));
+					}
+				}
+				last = std::max(last, t1 + 1);
+			}
+		}
+	}
+
+	cover = compress(covered);
+	halo = compress(nearby);
+}
+
+qint32 OccupancyIndex::rows() const {
+	return R;
+}
+
+qint32 OccupancyIndex::columns() const {
+	return C;
+}
+
+qint32 OccupancyIndex::horizon() const {
+	return last;
+}
+
+bool OccupancyIndex::occupied(qint32 x, qint32 y, qint32 t) const {
+	return overlaps(cover, x, y, t, t);
+}
+
+bool OccupancyIndex::occupiedDuring(qint32 x, qint32 y, qint32 t0, qint32 t1) const {
+	return overlaps(cover, x, y, t0, t1);
+}
+
+bool OccupancyIndex::near(qint32 x, qint32 y, qint32 t) const {
+	return overlaps(halo, x, y, t, t);
+}
+
+bool OccupancyIndex::nearDuring(qint32 x, qint32 y, qint32 t0, qint32 t1) const {
+	return overlaps(halo, x, y, t0, t1);
+}
+
+qint32 OccupancyIndex::nextFree(qint32 x, qint32 y, qint32 t) const {
+	if (x < 0 || x >= C || y < 0 || y >= R) return t;
+	qint32 i = find(halo, x, y, t);
+	// Touching runs are merged, so the second after a run is free
+	if (i < halo.offsets[x * R + y + 1] && halo.begins[i] <= t) {
+		return halo.ends[i] + 1;
+	}
+	return t;
+}
+
+OccupancyIndex::Runs OccupancyIndex::compress(Intervals &intervals) {
+	Runs runs;
+	runs.offsets.push_back(0);
+	for (qint32 c = 0; c < intervals.size(); ++c) {
+		QVector<Position> &list = intervals[c];
+		std::sort(list.begin(), list.end());
+		for (qint32 i = 0; i < list.size(); ++i) {
+			qint32 n = runs.begins.size();
+			if (n > runs.offsets.back() && list[i].first <= runs.ends[n - 1] + 1) {
+				runs.ends[n - 1] = std::max(runs.ends[n - 1], list[i].second);
+			} else {
+				runs.begins.push_back(list[i].first);
+				runs.ends.push_back(list[i].second);
+			}
+		}
+		runs.offsets.push_back(runs.begins.size());
+	}
+	return runs;
+}
+
+qint32 OccupancyIndex::find(const Runs &runs, qint32 x, qint32 y, qint32 t) const {
+	// The runs are disjoint, so their ends are sorted as well
+	qint32 cell = x * R + y;
+	const qint32 *ends = runs.ends.constData();
+	return qint32(std::lower_bound(ends + runs.offsets[cell], ends + runs.offsets[cell + 1], t) - ends);
+}
+
+bool OccupancyIndex::overlaps(const Runs &runs, qint32 x, qint32 y, qint32 t0, qint32 t1) const {
+	if (x < 0 || x >= C || y < 0 || y >= R) return false;
+	qint32 i = find(runs, x, y, t0);
+	return i < runs.offsets[x * R + y + 1] && runs.begins[i] <= t1;
+}
+
+WashDemand::WashDemand(qint32 x, qint32 y, qint32 release, qint32 deadline) : x(x), y(y), release(release), deadline(deadline) {}
+
+void Timeline::clear() {
+	ticks.clear();
+	types.clear();
+	payloads.clear();
+	contaminants.clear();
+	washes.clear();
+}
+
+void Timeline::addSounds(qreal time, qint32 sounds) {
+	ticks.push_back(toTick(time));
+	types.push_back(EventType::SoundEvent);
+	payloads.push_back(sounds);
+}
+
+void Timeline::addContaminant(qint32 time, qint32 id, qint32 x, qint32 y) {
+	ticks.push_back(toTick(time));
+	types.push_back(EventType::ContaminantEvent);
+	payloads.push_back(contaminants.size());
+	contaminants.push_back(Contaminant(time, id, x, y));
+}
+
+void Timeline::addError(qint32 time) {
+	ticks.push_back(toTick(time));
+	types.push_back(EventType::ErrorEvent);
+	payloads.push_back(0);
+}
+
+void Timeline::addWash(qint32 time, qint32 x, qint32 y) {
+	ticks.push_back(toTick(time));
+	types.push_back(EventType::WashEvent);
+	payloads.push_back(washes.size());
+	washes.push_back(Position(x, y));
+}
+
+void Timeline::removeWashes(qint64 after) {
+	// Removing events keeps the others sorted; the washes up to the tick have been applied, and stay
+	QVector<Position> kept;
+	qint32 n = 0;
+	for (qint32 i = 0; i < ticks.size(); ++i) {
+		if (types[i] == EventType::WashEvent) {
+			if (ticks[i] > after) continue;
+			kept.push_back(washes[payloads[i]]);
+			payloads[i] = kept.size() - 1;
+		}
+		ticks[n] = ticks[i];
+		types[n] = types[i];
+		payloads[n] = payloads[i];
+		++n;
+	}
+	ticks.resize(n);
+	types.resize(n);
+	payloads.resize(n);
+	washes = kept;
+}
+
+void Timeline::truncate(qint32 size) {
+	// The contaminants of an unfinalized timeline are in the order of their events
+	for (qint32 i = ticks.size() - 1; i >= size; --i) {
+		if (types[i] == EventType::ContaminantEvent) {
+			contaminants.pop_back();
+		}
+	}
+	ticks.resize(size);
+	types.resize(size);
+	payloads.resize(size);
+}
+
+void Timeline::finalize() {
+	QVector<qint32> order(ticks.size());
+	for (qint32 i = 0; i < order.size(); ++i) {
+		order[i] = i;
+	}
+	std::stable_sort(order.begin(), order.end(), [&](qint32 a, qint32 b) -> bool { return ticks[a] < ticks[b]; });
+
+	QVector<qint64> sortedTicks;
+	QVector<EventType> sortedTypes;
+	QVector<qint32> sortedPayloads;
+	sortedTicks.reserve(order.size());
+	sortedTypes.reserve(order.size());
+	sortedPayloads.reserve(order.size());
+
+	qint32 lastSound = -1; // index of the sound event of the current tick
+	for (qint32 i = 0; i < order.size(); ++i) {
+		qint32 k = order[i];
+		if (!sortedTicks.empty() && sortedTicks.back() != ticks[k]) {
+			lastSound = -1;
+		}
+		if (types[k] == EventType::SoundEvent) {
+			if (lastSound >= 0) {
+				sortedPayloads[lastSound] |= payloads[k];
+				continue;
+			}
+			lastSound = sortedTicks.size();
+		}
+		sortedTicks.push_back(ticks[k]);
+		sortedTypes.push_back(types[k]);
+		sortedPayloads.push_back(payloads[k]);
+	}
+
+	ticks = sortedTicks;
+	types = sortedTypes;
+	payloads = sortedPayloads;
+}
+
+void Timeline::finalizeFrom(qint32 from) {
+	// New events are hardly ever earlier than the last ones before them, so each is moved back into place
+	for (qint32 i = from; i < ticks.size(); ++i) {
+		qint32 j = i;
+		for (; j > 0 && ticks[j - 1] > ticks[j]; --j) {
+			std::swap(ticks[j - 1], ticks[j]);
+			std::swap(types[j - 1], types[j]);
+			std::swap(payloads[j - 1], payloads[j]);
+		}
+		if (types[j] != EventType::SoundEvent) continue;
+
+		for (qint32 k = j - 1; k >= 0 && ticks[k] == ticks[j]; --k) {
+			if (types[k] == EventType::SoundEvent) {
+				payloads[k] |= payloads[j];
+				ticks.remove(j);
+				types.remove(j);
+				payloads.remove(j);
+				--i;
+				break;
+			}
+		}
+	}
+}
+
+qint32 Timeline::size() const {
+	return ticks.size();
+}
+
+qint32 Timeline::upperBound(qint64 tick) const {
+	return qint32(std::upper_bound(ticks.begin(), ticks.end(), tick) - ticks.begin());
+}
+
+qint64 Timeline::tick(qint32 i) const {
+	return ticks[i];
+}
+
+EventType Timeline::type(qint32 i) const {
+	return types[i];
+}
+
+qint32 Timeline::sounds(qint32 i) const {
+	return payloads[i];
+}
+
+const Contaminant &Timeline::contaminant(qint32 i) const {
+	return contaminants[payloads[i]];
+}
+
+const Position &Timeline::wash(qint32 i) const {
+	return washes[payloads[i]];
+}
+
+qint32 Timeline::errorTime() const {
+	for (qint32 i = 0; i < types.size(); ++i) {
+		if (types[i] == EventType::ErrorEvent) {
+			return qint32(ticks[i] / ticksPerSecond);
+		}
+	}
+	return -2;
+}
+
+qint64 Timeline::toTick(qreal time) {
+	return qint64(floor(time * ticksPerSecond + 0.5));
+}
+
 DropletStatus interpolation(DropletStatus a, DropletStatus b, qreal t, qreal &x, qreal &y) {
 	if (fabs(a.t - b.t) < eps) {
 		x = b.x;
@@ -86,16 +462,419 @@ DropletStatus interpolation(DropletStatus a, DropletStatus b, qreal t, qreal &x,
 	return ans;
 }
 
-void loadFile(const QString &url, const ChipConfig &config, QVector<Droplet> &droplets, qint64 &minTime, qint64 &maxTime, SoundList &sounds, ErrorLog &error, ContaminantList &contaminants) {
+ProtocolLoader::ProtocolLoader() : seed(0), recover(false), live(false), extended(false), next(0), second(noSecond), frontier(0), random(0), count(0), minTime(0), maxTime(0), error(-2, ""), resumed(0) {}
+
+bool ProtocolLoader::load(const QString &url, const ChipConfig &config, quint64 seed, bool recover, const Progress &progress) {
+	this->url = url;
+	this->config = config;
+	this->seed = seed;
+	this->recover = recover;
+	live = false;
+
+	commandList.clear();
+	commandLines.clear();
+	CommandExpander expander(url);
+	// A file that cannot be read is reported like one that cannot be parsed
+	if (!readText(text, parseError) || !parse(0, text.size(), 0, expander, commandList, commandLines, parseError, progress)) {
+		if (parseError.isEmpty()) return false;
+		commandList.clear();
+		commandLines.clear();
+	}
+	extended = expander.usedDirectives();
+	includes = expander.includedFiles();
+	sortCommands(commandList, commandLines);
+
+	reset();
+	return simulate(0, progress);
+}
+
+void ProtocolLoader::reset() {
+	posMap.clear();
+	occupied = CellMask(config.rows, config.columns);
+	ghosts.clear();
+	removeList.clear();
+	steps.clear();
+	next = 0;
+	second = noSecond;
+	held.clear();
+	random = Random(seed, streamDroplets);
+	count = 0;
+	droplets.clear();
+	timeline.clear();
+	minTime = 0;
+	maxTime = -(1ll << 60);
+	error = ErrorLog(-2, "");
+	errors.clear();
+
+	checkpoints.clear();
+	checkpoint(0);
+	resumed = 0;
+}
+
+bool ProtocolLoader::reload(const Progress &progress) {
+	QByteArray old = text;
+	QString oldError = parseError, message;
+	bool read = readText(text, message);
+	if (read && text == old && !extended) return false;
+
+	QVector<Command> commands;
+	QVector<qint32> lines;
+	if (!read) {
+		parseError = message;
+	} else if (extended || !oldError.isEmpty() || !reparse(old, commands, lines)) {
+		// Blocks and macros reach over any number of lines, and included files are not compared; after an error, the
+		// commands of the other lines are gone. The text is parsed again as a whole
+		commands.clear();
+		lines.clear();
+		CommandExpander expander(url);
+		if (!parse(0, text.size(), 0, expander, commands, lines, parseError, progress)) {
+			if (parseError.isEmpty()) return false;
+			commands.clear();
+			lines.clear();
+		}
+		extended = expander.usedDirectives();
+		includes = expander.includedFiles();
+		sortCommands(commands, lines);
+	} else {
+		parseError.clear();
+	}
+
+	// Commands before the first difference are simulated the same way as before
+	qint32 same = 0;
+	while (same < commands.size() && same < commandList.size() && sameCommand(commands[same], commandList[same])) {
+		++same;
+	}
+	bool changed = same < commands.size() || same < commandList.size() || parseError != oldError;
+	commandList = commands;
+	commandLines = lines; // even if only lines were added or removed
+	if (!changed) return false;
+
+	// A checkpoint at the first difference itself may not start a second any more
+	while (checkpoints.size() > 1 && checkpoints.back().command >= same) {
+		checkpoints.pop_back();
+	}
+	resumed = checkpoints.size() - 1;
+	restore(checkpoints[resumed]);
+	return simulate(checkpoints[resumed].command, progress);
+}
+
+bool ProtocolLoader::reparse(const QByteArray &old, QVector<Command> &commands, QVector<qint32> &lines) const {
+	// Only the lines between the beginning and the end the two texts share are parsed again
+	qint32 n = std::min(old.size(), text.size()), head = 0, tail = 0;
+	while (head < n && old[head] == text[head]) {
+		++head;
+	}
+	while (head > 0 && old[head - 1] != '\n') {
+		--head;
+	}
+	while (tail < n - head && old[old.size() - 1 - tail] == text[text.size() - 1 - tail]) {
+		++tail;
+	}
+	auto lineStart = [head](const QByteArray &s, qint32 i) -> bool { return i == head || s[i - 1] == '\n'; };
+	while (tail > 0 && !(lineStart(old, old.size() - tail) && lineStart(text, text.size() - tail))) {
+		--tail;
+	}
+	qint32 oldEnd = old.size() - tail, newEnd = text.size() - tail;
+	qint32 headLine = qint32(std::count(text.constData(), text.constData() + head, '\n'));
+	qint32 oldTailLine = headLine + qint32(std::count(old.constData() + head, old.constData() + oldEnd, '\n'));
+	qint32 newTailLine = headLine + qint32(std::count(text.constData() + head, text.constData() + newEnd, '\n'));
+
+	QVector<Command> parsed;
+	QVector<qint32> parsedLines;
+	CommandExpander expander(url);
+	QString message;
+	if (!parse(head, newEnd, headLine, expander, parsed, parsedLines, message) || expander.usedDirectives()) return false;
+	sortCommands(parsed, parsedLines);
+
+	// The commands of the other lines keep their order, the new ones are merged in by time and line
+	commands.reserve(commandList.size() + parsed.size());
+	lines.reserve(commandList.size() + parsed.size());
+	qint32 j = 0;
+	for (qint32 i = 0; i < commandList.size(); ++i) {
+		qint32 line = commandLines[i];
+		if (tail > 0 && line >= oldTailLine) {
+			line += newTailLine - oldTailLine;
+		} else if (line >= headLine) {
+			continue;
+		}
+		for (; j < parsed.size() && (parsed[j].t < commandList[i].t || (parsed[j].t == commandList[i].t && parsedLines[j] < line)); ++j) {
+			commands.push_back(parsed[j]);
+			lines.push_back(parsedLines[j]);
+		}
+		commands.push_back(commandList[i]);
+		lines.push_back(line);
+	}
+	for (; j < parsed.size(); ++j) {
+		commands.push_back(parsed[j]);
+		lines.push_back(parsedLines[j]);
+	}
+	return true;
+}
+
+qint32 ProtocolLoader::resumeTime() const {
+	const Checkpoint &p = checkpoints[resumed];
+	qint32 t = p.command < commandList.size() ? commandList[p.command].t : -1;
+	if (!p.steps.empty() && (t < 0 || p.steps.front().t < t)) {
+		t = p.steps.front().t;
+	}
+	return t;
+}
+
+QStringList ProtocolLoader::files() const {
+	return QStringList(url) + includes;
+}
+
+void ProtocolLoader::result(QVector<Droplet> &droplets, qint64 &minTime, qint64 &maxTime, Timeline &timeline, ErrorLog &error, ErrorList *errors) const {
+	droplets = this->droplets;
+	minTime = this->minTime;
+	maxTime = this->maxTime;
+	timeline = this->timeline;
+	error = this->error;
+	if (!parseError.isEmpty()) {
+		error = ErrorLog(0, parseError);
+	}
+	if (errors != nullptr) {
+		*errors = this->errors;
+		std::stable_sort(errors->begin(), errors->end(), [](const ErrorLog &a, const ErrorLog &b) -> bool { return a.t < b.t; });
+		if (!parseError.isEmpty()) {
+			errors->push_front(error);
+		}
+	}
+
+	if (error.t >= 0) {
+		timeline.addError(error.t);
+	}
+
+	qint32 timeMaximum = lastSecond();
+	for (qint32 i = 0; i < droplets.size(); ++i) {
+		DropletStatus last = droplets[i].back();
+		if (fabs(last.rx - radius) < eps && fabs(last.ry - radius) < eps) {
+			last.t = timeMaximum;
+			droplets[i].push_back(last); // Push a final state so that status is keeped when error occurs
+		}
+	}
+
+	timeline.finalize();
+}
+
+void ProtocolLoader::startLive(const ChipConfig &config, quint64 seed, bool recover) {
+	url.clear();
+	this->config = config;
+	this->seed = seed;
+	this->recover = recover;
+	live = true;
+	text.clear();
+	extended = false;
+	includes.clear();
+	parseError.clear();
+	commandList.clear();
+	commandLines.clear();
+	frontier = 0;
+	reset();
+}
+
+bool ProtocolLoader::append(const CommandRecord &record, QString &message) {
+	if (!record.values.empty() && record.values[0] < frontier) {
+		message = QString("Line %1: second %2 is earlier than second %3.").arg(record.line + 1).arg(record.values[0]).arg(frontier);
+		return false;
+	}
+	qint32 first = commandList.size();
+	addCommand(record, commandList);
+	if (commandList.size() == first) return true;
+	frontier = commandList[first].t;
+
+	// The second step of a Merge or a Split may be waiting, and commands of an earlier second go before it
+	for (qint32 i = first; i < commandList.size(); ++i) {
+		commandLines.push_back(record.line);
+		for (qint32 k = i; k > next && commandList[k - 1].t > commandList[k].t; --k) {
+			std::swap(commandList[k - 1], commandList[k]);
+			std::swap(commandLines[k - 1], commandLines[k]);
+		}
+	}
+	simulateLive(frontier);
+	return true;
+}
+
+void ProtocolLoader::endLive() {
+	simulateLive(std::numeric_limits<qint32>::max());
+	frontier = std::numeric_limits<qint32>::max();
+}
+
+void ProtocolLoader::simulateLive(qint32 until) {
+	// Droplets held at the frontier go on from their own last state
+	for (qint32 id : held) {
+		droplets[id].pop_back();
+	}
+	held.clear();
+
+	// Without recovery nothing is simulated after the first error, as when loading a file
+	bool failed = error.t >= 0;
+	if (!failed || recover) {
+		qint32 events = timeline.size();
+		simulate(next, Progress(), until);
+		if (!failed && error.t >= 0) {
+			timeline.addError(error.t);
+		}
+		timeline.finalizeFrom(events);
+	}
+
+	// Droplets on the chip stay in sight until their next command, as result() keeps them until the end
+	if (until == std::numeric_limits<qint32>::max()) {
+		qint32 timeMaximum = lastSecond();
+		for (qint32 i = 0; i < droplets.size(); ++i) {
+			DropletStatus last = droplets[i].back();
+			if (fabs(last.rx - radius) < eps && fabs(last.ry - radius) < eps) {
+				last.t = timeMaximum;
+				droplets[i].push_back(last);
+			}
+		}
+		return;
+	}
+	for (auto it = posMap.constBegin(); it != posMap.constEnd(); ++it) {
+		DropletStatus last = droplets[it.value()].back();
+		if (last.t < until && fabs(last.rx - radius) < eps && fabs(last.ry - radius) < eps) {
+			last.t = until;
+			droplets[it.value()].push_back(last);
+			held.push_back(it.value());
+		}
+	}
+}
+
+// One second after the last step
+qint32 ProtocolLoader::lastSecond() const {
+	qint32 timeMaximum = 0;
+	for (const Command &c : commandList) {
+		timeMaximum = std::max(timeMaximum, c.t + 1 + c.path.size() / 2);
+	}
+	return timeMaximum;
+}
+
+qint32 ProtocolLoader::liveTime() const {
+	return frontier;
+}
+
+void ProtocolLoader::exchange(QVector<Droplet> &droplets, Timeline &timeline) {
+	this->droplets.swap(droplets);
+	std::swap(this->timeline, timeline);
+}
+
+void ProtocolLoader::liveResult(qint64 &minTime, qint64 &maxTime, ErrorLog &error, ErrorList &errors) const {
+	minTime = this->minTime;
+	maxTime = this->maxTime;
+	error = this->error;
+	for (qint32 i = errors.size(); i < this->errors.size(); ++i) {
+		errors.push_back(this->errors[i]);
+	}
+}
+
+bool ProtocolLoader::readText(QByteArray &text, QString &message) const {
+	text.clear();
 	QFile file(url);
-	file.open(QFile::ReadOnly | QFile::Text);
-	QTextStream fs(&file);
+	if (!file.open(QFile::ReadOnly)) {
+		message = QString("Cannot open %1: %2").arg(url, file.errorString());
+		return false;
+	}
+	text = file.readAll();
+	return true;
+}
 
-	QMap<Position, qint32> posMap;
+bool ProtocolLoader::parse(qint32 begin, qint32 end, qint32 line, CommandExpander &expander, QVector<Command> &commands, QVector<qint32> &lines, QString &message, const Progress &progress) const {
+	message.clear();
+	qint32 made = 0;
+	qint64 position = begin;
+	auto sink = [&](const CommandRecord &record, QString &) -> bool {
+		// Directives may make far more commands than there are lines
+		if (progress && ++made % expansionProgressInterval == 0 && !progress(position, text.size(), 0, 0)) return false;
+		addCommand(record, commands);
+		while (lines.size() < commands.size()) {
+			lines.push_back(record.line);
+		}
+		return true;
+	};
 
-	QVector<Command> commandList;
+	for (qint32 k = 0; begin < end; ++line, ++k) {
+		if (progress && k % progressInterval == 0 && !progress(begin, text.size(), 0, 0)) return false;
 
-	auto findIdFromPosition = [&](qint32 x, qint32 y) -> qint32 {
+		qint32 next = text.indexOf('\n', begin);
+		if (next < 0 || next > end) {
+			next = end;
+		}
+		position = begin;
+		if (!expander.feed(QString::fromUtf8(text.constData() + begin, next - begin), line, sink, message)) return false;
+		begin = next + 1;
+	}
+	return expander.finish(message);
+}
+
+void ProtocolLoader::addCommand(const CommandRecord &record, QVector<Command> &commands) const {
+	const QVector<qint32> &values = record.values; // the second, then x and y of every cell, as in the file
+	auto x = [&values](qint32 i) -> qint32 { return values[i] - 1; };
+	auto y = [&values, this](qint32 i) -> qint32 { return config.rows - values[i]; };
+
+	if (record.name == "input" || record.name == "output") {
+		if (values.size() < 3) return;
+		commands.push_back(Command(record.name == "input" ? CommandType::Input : CommandType::Output, values[0], x(1), y(2)));
+	} else if (record.name == "merge") {
+		if (values.size() < 5) return;
+		Command cmd(
+			CommandType::Merging,
+			values[0],
+			x(1),
+			y(2),
+			x(3),
+			y(4),
+			(values[1] + values[3] - 2) / 2,
+			(config.rows * 2 - values[2] - values[4]) / 2
+		);
+		commands.push_back(cmd);
+		cmd.type = CommandType::Merged;
+		++cmd.t;
+		commands.push_back(cmd);
+	} else if (record.name == "split") {
+		if (values.size() < 7) return;
+		Command cmd(CommandType::Splitting, values[0], x(1), y(2), x(3), y(4), x(5), y(6));
+		commands.push_back(cmd);
+		cmd.type = CommandType::Split;
+		++cmd.t;
+		commands.push_back(cmd);
+	} else if (record.name == "mix") {
+		// One command for the whole path, its steps are taken one by one while simulating
+		if (values.size() < 5) return;
+		Command cmd(CommandType::Mix, values[0], x(1), y(2), x(3), y(4));
+		cmd.path.reserve(values.size() - 5);
+		for (qint32 i = 5; i + 1 < values.size(); i += 2) {
+			cmd.path.push_back(x(i));
+			cmd.path.push_back(y(i + 1));
+		}
+		commands.push_back(cmd);
+	} else if (record.name == "move") {
+		if (values.size() < 5) return;
+		commands.push_back(Command(CommandType::Move, values[0], x(1), y(2), x(3), y(4)));
+	}
+}
+
+void ProtocolLoader::sortCommands(QVector<Command> &commands, QVector<qint32> &lines) {
+	// Commands of the same second keep the order of the file, so that loading the same file twice gives the same result
+	QVector<qint32> order(commands.size());
+	for (qint32 i = 0; i < order.size(); ++i) {
+		order[i] = i;
+	}
+	std::stable_sort(order.begin(), order.end(), [&](qint32 a, qint32 b) -> bool { return commands[a].t < commands[b].t; });
+
+	QVector<Command> sortedCommands;
+	QVector<qint32> sortedLines;
+	sortedCommands.reserve(order.size());
+	sortedLines.reserve(order.size());
+	for (qint32 i : order) {
+		sortedCommands.push_back(commands[i]);
+		sortedLines.push_back(lines[i]);
+	}
+	commands = sortedCommands;
+	lines = sortedLines;
+}
+
+bool ProtocolLoader::simulate(qint32 from, const Progress &progress, qint32 until) {
+	auto findIdFromPosition = [this](qint32 x, qint32 y) -> qint32 {
 		auto pos = Position(x, y);
 		if (!posMap.count(pos)) {
 			return -1;
@@ -104,155 +883,149 @@ void loadFile(const QString &url, const ChipConfig &config, QVector<Droplet> &dr
 		}
 	};
 
-	auto putDroplet = [&](qint32 x, qint32 y, qint32 id) -> bool {
+	auto checkPosition = [this](qint32 x, qint32 y) -> bool {
+		return x >= 0 && x < config.columns && y >= 0 && y < config.rows;
+	};
+
+	// posMap changes through these, and the mask of occupied cells with it
+	auto occupy = [this, checkPosition](const Position &pos, qint32 id) {
+		posMap[pos] = id;
+		if (checkPosition(pos.first, pos.second)) {
+			occupied.set(pos.first, pos.second);
+		}
+	};
+
+	auto vacate = [this, checkPosition](const Position &pos) {
+		posMap.remove(pos);
+		if (checkPosition(pos.first, pos.second)) {
+			occupied.set(pos.first, pos.second, false);
+		}
+	};
+
+	auto putDroplet = [this, checkPosition, occupy](qint32 x, qint32 y, qint32 id) -> bool {
 		auto pos = Position(x, y);
 		for (qint32 k = 0; k < 8; ++k) {
 			qint32 xx = x + dirX[k], yy = y + dirY[k];
+			// Most neighbours are free, which the mask tells without a lookup; only set cells and cells off the
+			// chip need posMap for the droplet there
+			if (checkPosition(xx, yy) && !occupied.test(xx, yy)) continue;
 			auto pok = Position(xx, yy);
 			if (posMap.count(pok) && posMap[pok] != id) {
 				return false;
 			}
 		}
-		posMap[pos] = id;
+		occupy(pos, id);
+		ghosts.remove(pos);
 		return true;
 	};
 
-	auto removeDroplet = [&](qint32 x, qint32 y) {
-		posMap.remove(Position(x, y));
+	auto removeDroplet = [vacate](qint32 x, qint32 y) {
+		vacate(Position(x, y));
 	};
 
-	auto checkPosition = [&](qint32 x, qint32 y) -> bool {
-		return x >= 0 && x < config.columns && y >= 0 && y < config.rows;
+	auto report = [this](qint32 t, const QString &msg) -> bool {
+		if (error.t < 0) {
+			error = ErrorLog(t, msg);
+		}
+		if (!recover) return false;
+		errors.push_back(ErrorLog(t, msg));
+		return true;
 	};
 
-	qint32 count = 0;
-
-	minTime = 0;
-	maxTime = -(1ll << 60);
-
-	error = ErrorLog(-2, "");
+	auto quarantine = [this, checkPosition](qint32 id, qint32 t) {
+		for (auto it = posMap.begin(); it != posMap.end(); ) {
+			if (it.value() == id) {
+				if (checkPosition(it.key().first, it.key().second)) {
+					occupied.set(it.key().first, it.key().second, false);
+				}
+				it = posMap.erase(it);
+			} else {
+				++it;
+			}
+		}
+		DropletStatus last = droplets[id].back();
+		droplets[id].push_back(DropletStatus(std::max(qreal(t + 1), last.t), last.x, last.y, 0, 0, 0, last.h, last.s, last.v));
+	};
 
-	while (!fs.atEnd()) {
-		QStringList tokens = fs.readLine()
-							   .replace(',', ' ')
-							   .replace(';', ' ')
-							   .simplified()
-							   .toLower()
-							   .split(' ', QString::SkipEmptyParts);
-
-		if (tokens.empty()) continue;
-		assert(tokens.size() % 2 == 0);
-
-		if (tokens[0] == "input") {
-			commandList.push_back(Command(
-				CommandType::Input,
-				tokens[1].toInt(),
-				tokens[2].toInt() - 1,
-				config.rows - tokens[3].toInt()
-			));
-		} else if (tokens[0] == "output") {
-			commandList.push_back(Command(
-				CommandType::Output,
-				tokens[1].toInt(),
-				tokens[2].toInt() - 1,
-				config.rows - tokens[3].toInt()
-			));
-		} else if (tokens[0] == "merge") {
-			Command cmd(
-				CommandType::Merging,
-				tokens[1].toInt(),
-				tokens[2].toInt() - 1,
-				config.rows - tokens[3].toInt(),
-				tokens[4].toInt() - 1,
-				config.rows - tokens[5].toInt(),
-				(tokens[2].toInt() + tokens[4].toInt() - 2) / 2,
-				(config.rows * 2 - tokens[3].toInt() - tokens[5].toInt()) / 2
-			);
-			commandList.push_back(cmd);
-			cmd.type = CommandType::Merged;
-			++cmd.t;
-			commandList.push_back(cmd);
-		} else if (tokens[0] == "split") {
-			Command cmd(
-				CommandType::Splitting,
-				tokens[1].toInt(),
-				tokens[2].toInt() - 1,
-				config.rows - tokens[3].toInt(),
-				tokens[4].toInt() - 1,
-				config.rows - tokens[5].toInt(),
-				tokens[6].toInt() - 1,
-				config.rows - tokens[7].toInt()
-			);
-			commandList.push_back(cmd);
-			cmd.type = CommandType::Split;
-			++cmd.t;
-			commandList.push_back(cmd);
-		} else if (tokens[0] == "mix") {
-			for (qint32 i = 4, t = tokens[1].toInt(); i < tokens.size(); i += 2, ++t) {
-				commandList.push_back(Command(
-					CommandType::Mix,
-					t,
-					tokens[i - 2].toInt() - 1,
-					config.rows - tokens[i - 1].toInt(),
-					tokens[i].toInt() - 1,
-					config.rows - tokens[i + 1].toInt()
-				));
-			}
-		} else if (tokens[0] == "move") {
-			commandList.push_back(Command(
-				CommandType::Move,
-				tokens[1].toInt(),
-				tokens[2].toInt() - 1,
-				config.rows - tokens[3].toInt(),
-				tokens[4].toInt() - 1,
-				config.rows - tokens[5].toInt()
-			));
-		}
-	}
-
-	std::sort(commandList.begin(), commandList.end(), [](Command a, Command b) -> bool { return a.t < b.t; });
+	auto heapOrder = [this](const PathStep &a, const PathStep &b) -> bool { return later(a, b); };
+
+	// Commands of the list and the later steps of Mixes, merged in the order of time, then of the file
+	qint32 i = from;
+	for (qint32 done = 0; ; ++done) {
+		bool fromPath = !steps.empty() && (i == commandList.size() || later(PathStep({commandList[i].t, i, 0}), steps.front()));
+		if (!fromPath && i == commandList.size()) break;
+		if (progress && done % progressInterval == 0 && !progress(text.size(), text.size(), i, commandList.size())) return false;
+		Command c = fromPath ? pathStep(steps.front()) : commandList[i]; // moveToPort changes it
+		if (c.t > until) break;
+
+		// Cells left during the last second are free from this one on
+		if (second != c.t && second != noSecond) {
+			for (qint32 j = 0; j < removeList.size(); ++j) {
+				removeDroplet(removeList[j].first, removeList[j].second);
+			}
+			removeList.clear();
 
-	droplets.clear();
-	sounds.clear();
-	contaminants.clear();
+			if (!live && i - checkpoints.back().command >= checkpointInterval) {
+				checkpoint(i);
+			}
+		}
+		second = c.t;
+
+		if (fromPath) {
+			PathStep s = steps.front();
+			std::pop_heap(steps.begin(), steps.end(), heapOrder);
+			steps.pop_back();
+			if (s.step < commandList[s.command].path.size() / 2) {
+				steps.push_back(PathStep({s.t + 1, s.command, s.step + 1}));
+				std::push_heap(steps.begin(), steps.end(), heapOrder);
+			}
+		} else {
+			if (c.type == CommandType::Mix && !c.path.empty()) {
+				steps.push_back(PathStep({c.t + 1, i, 1}));
+				std::push_heap(steps.begin(), steps.end(), heapOrder);
+			}
+			++i;
+		}
 
-	QVector<Position> removeList;
-	for (qint32 i = 0; i < commandList.size(); ++i) {
-		Command &c = commandList[i];
 		if (c.type == CommandType::Input) {
 			maxTime = std::max(maxTime, c.t * qint64(1000));
 
 			if (!isPortType(c.x1, c.y1, config, PortType::input)) {
-				error = ErrorLog(c.t, QString("%1: Cannot place a droplet at (%2, %3): position not beside an input port.").arg(c.t).arg(c.x1 + 1).arg(config.rows - c.y1));
-				break;
+				if (!report(c.t, QString("%1: Cannot place a droplet at (%2, %3): position not beside an input port.").arg(c.t).arg(c.x1 + 1).arg(config.rows - c.y1))) break;
+				ghosts.insert(Position(c.x1, c.y1));
+				continue;
 			}
-			DropletStatus mnt(c.t, c.x1, c.y1, radius, radius, 0xff, randInt(0, 359), randInt(127, 255), randInt(127, 255));
+			DropletStatus mnt(c.t, c.x1, c.y1, radius, radius, 0xff, random.randInt(0, 359), random.randInt(127, 255), random.randInt(127, 255));
 
 			moveToPort(c.x1, c.y1, config);
 			DropletStatus mnt0(c.t - 1, c.x1, c.y1, 0, 0, 0, mnt.h, mnt.s, mnt.v);
 
 			if (!putDroplet(mnt.x, mnt.y, count++)) {
-				error = ErrorLog(c.t, QString("%1: Cannot place a droplet at (%2, %3): static distance constraint failed.").arg(c.t).arg(c.x1 + 1).arg(config.rows - c.y1));
-				break;
+				if (!report(c.t, QString("%1: Cannot place a droplet at (%2, %3): static distance constraint failed.").arg(c.t).arg(mnt.x + 1).arg(config.rows - mnt.y))) break;
+				--count;
+				ghosts.insert(Position(mnt.x, mnt.y));
+				continue;
 			}
 
 			droplets.push_back(Droplet({mnt0, mnt}));
 
 			minTime = std::min(minTime, qint64(mnt0.t * 1000));
-			contaminants.push_back(Contaminant(c.t, count - 1, mnt.x, mnt.y));
+			timeline.addContaminant(c.t, count - 1, mnt.x, mnt.y);
 		} else if (c.type == CommandType::Output) {
 			maxTime = std::max(maxTime, qint64((c.t + 1) * 1000));
 
 			qint32 id = findIdFromPosition(c.x1, c.y1);
 
 			if (id < 0 || id >= droplets.size()) {
-				error = ErrorLog(c.t, QString("%1: Cannot output a droplet at (%2, %3): no droplet here.").arg(c.t).arg(c.x1 + 1).arg(config.rows - c.y1));
-				break;
+				if (ghosts.remove(Position(c.x1, c.y1))) continue;
+				if (!report(c.t, QString("%1: Cannot output a droplet at (%2, %3): no droplet here.").arg(c.t).arg(c.x1 + 1).arg(config.rows - c.y1))) break;
+				continue;
 			}
 
 			if (!isPortType(c.x1, c.y1, config, PortType::output)) {
-				error = ErrorLog(c.t, QString("%1: Cannot output the droplet at (%2, %3): position not beside an input port.").arg(c.t).arg(c.x1 + 1).arg(config.rows - c.y1));
-				break;
+				if (!report(c.t, QString("%1: Cannot output the droplet at (%2, %3): position not beside an input port.").arg(c.t).arg(c.x1 + 1).arg(config.rows - c.y1))) break;
+				quarantine(id, c.t);
+				continue;
 			}
 
 			auto iter = droplets[id].back();
@@ -272,13 +1045,16 @@ void loadFile(const QString &url, const ChipConfig &config, QVector<Droplet> &dr
 			qint32 id = findIdFromPosition(c.x1, c.y1);
 
 			if (id < 0 || id >= droplets.size()) {
-				error = ErrorLog(c.t, QString("%2: Cannot %1 at (%3, %4): no droplet here.").arg(c.type == CommandType::Move ? "move" : "mix").arg(c.t).arg(c.x1 + 1).arg(config.rows - c.y1));
-				break;
+				if (!ghosts.remove(Position(c.x1, c.y1)) && !report(c.t, QString("%2: Cannot %1 at (%3, %4): no droplet here.").arg(c.type == CommandType::Move ? "move" : "mix").arg(c.t).arg(c.x1 + 1).arg(config.rows - c.y1))) break;
+				ghosts.insert(Position(c.x2, c.y2));
+				continue;
 			}
 
 			if (!checkPosition(c.x2, c.y2)) {
-				error = ErrorLog(c.t, QString("%2: Cannot %1 from (%3, %4) to (%5, %6): Position out of grid").arg(c.type == CommandType::Move ? "move" : "mix").arg(c.t).arg(c.x1).arg(c.y1).arg(c.x2).arg(c.y2));
-				break;
+				if (!report(c.t, QString("%2: Cannot %1 from (%3, %4) to (%5, %6): Position out of grid").arg(c.type == CommandType::Move ? "move" : "mix").arg(c.t).arg(c.x1).arg(c.y1).arg(c.x2).arg(c.y2))) break;
+				quarantine(id, c.t);
+				ghosts.insert(Position(c.x2, c.y2));
+				continue;
 			}
 
 			auto iter = droplets[id].back();
@@ -286,21 +1062,26 @@ void loadFile(const QString &url, const ChipConfig &config, QVector<Droplet> &dr
 			DropletStatus mnt1(c.t, c.x1, c.y1, radius, radius, iter.a, iter.h, iter.s, iter.v),
 				mnt2(c.t + 1, c.x2, c.y2, radius, radius, iter.a, iter.h, iter.s, iter.v);
 
-			droplets[id].push_back(mnt1);
+			// Steps of a run share the keyframe between them
+			if (iter.t != mnt1.t || iter.x != mnt1.x || iter.y != mnt1.y || iter.rx != mnt1.rx || iter.ry != mnt1.ry) {
+				droplets[id].push_back(mnt1);
+			}
 			removeList.push_back(Position(mnt1.x, mnt1.y));
 
 			if (!putDroplet(mnt2.x, mnt2.y, id)) {
-				error = ErrorLog(c.t, QString("%2: Cannot %1 from (%3, %4) to (%5, %6): dynamic distance constraint failed.").arg(c.type == CommandType::Move ? "move" : "mix").arg(c.t).arg(c.x1 + 1).arg(config.rows - c.y1).arg(c.x2 + 1).arg(config.rows - c.y2));
-				break;
+				if (!report(c.t, QString("%2: Cannot %1 from (%3, %4) to (%5, %6): dynamic distance constraint failed.").arg(c.type == CommandType::Move ? "move" : "mix").arg(c.t).arg(c.x1 + 1).arg(config.rows - c.y1).arg(c.x2 + 1).arg(config.rows - c.y2))) break;
+				quarantine(id, c.t);
+				ghosts.insert(Position(c.x2, c.y2));
+				continue;
 			}
 
 			droplets[id].push_back(mnt2);
 
 			maxTime = std::max(maxTime, qint64(mnt2.t * 1000));
 
-			sounds[mnt2.t - soundOffset] |= sndFxMove;
+			timeline.addSounds(mnt2.t - soundOffset, sndFxMove);
 
-			contaminants.push_back(Contaminant(c.t + 1, id, mnt2.x, mnt2.y));
+			timeline.addContaminant(c.t + 1, id, mnt2.x, mnt2.y);
 		} else if (c.type == CommandType::Merging) {
 			maxTime = std::max(maxTime, c.t * qint64(1000));
 
@@ -308,12 +1089,23 @@ void loadFile(const QString &url, const ChipConfig &config, QVector<Droplet> &dr
 			qint32 id2 = findIdFromPosition(c.x2, c.y2);
 
 			if (id1 < 0 || id1 >= droplets.size() || id2 < 0 || id2 >= droplets.size()) {
-				error = ErrorLog(c.t, QString("%1: Cannot merge (%2, %3) and (%4, %5): no droplet here.").arg(c.t).arg(c.x1 + 1).arg(config.rows - c.y1).arg(c.x2 + 1).arg(config.rows - c.y2));
-				break;
+				bool ghost1 = id1 < 0 && ghosts.remove(Position(c.x1, c.y1)), ghost2 = id2 < 0 && ghosts.remove(Position(c.x2, c.y2));
+				if ((id1 < 0 && !ghost1) || (id2 < 0 && !ghost2)) {
+					if (!report(c.t, QString("%1: Cannot merge (%2, %3) and (%4, %5): no droplet here.").arg(c.t).arg(c.x1 + 1).arg(config.rows - c.y1).arg(c.x2 + 1).arg(config.rows - c.y2))) break;
+				}
+				// A droplet merged with a ghost is a ghost too, up to the Merged step
+				if (id1 >= 0) {
+					quarantine(id1, c.t);
+				}
+				if (id2 >= 0) {
+					quarantine(id2, c.t);
+				}
+				ghosts.insert(Position(c.x3, c.y3));
+				continue;
 			}
 
-			posMap.remove(Position(c.x1, c.y1));
-			posMap.remove(Position(c.x2, c.y2));
+			vacate(Position(c.x1, c.y1));
+			vacate(Position(c.x2, c.y2));
 			// Note that here we cannot use the remove-list
 
 			auto iter = droplets[id1].back();
@@ -331,7 +1123,7 @@ void loadFile(const QString &url, const ChipConfig &config, QVector<Droplet> &dr
 				radius * (abs(s1.x - s2.x) + 1),
 				radius * (abs(s1.y - s2.y) + 1),
 				(s1.a + s2.a) / 2,
-				((s1.h + s2.h) / 2 + randInt(0, 1) * 180) % 360,
+				((s1.h + s2.h) / 2 + random.randInt(0, 1) * 180) % 360,
 				(s1.s + s2.s) / 2,
 				(s1.v + s2.v) / 2
 			);
@@ -339,9 +1131,9 @@ void loadFile(const QString &url, const ChipConfig &config, QVector<Droplet> &dr
 			droplets[id1].push_back(s);
 			droplets[id2].push_back(s);
 
-			posMap[Position(s1.x, s1.y)] = id2;
-			posMap[Position(s2.x, s2.y)] = id2;
-			posMap[Position(s.x, s.y)] = id2;
+			occupy(Position(s1.x, s1.y), id2);
+			occupy(Position(s2.x, s2.y), id2);
+			occupy(Position(s.x, s.y), id2);
 
 			assert(putDroplet(s1.x, s1.y, id2) && putDroplet(s2.x, s2.y, id2) && putDroplet(s.x, s.y, id2));
 
@@ -351,7 +1143,11 @@ void loadFile(const QString &url, const ChipConfig &config, QVector<Droplet> &dr
 
 			qint32 id = findIdFromPosition(c.x3, c.y3);
 
-			assert(id >= 0 && id < droplets.size());
+			if (id < 0) {
+				if (!ghosts.contains(Position(c.x3, c.y3)) && !report(c.t - 1, QString("%1: Cannot merge (%2, %3) and (%4, %5): no droplet here.").arg(c.t - 1).arg(c.x1 + 1).arg(config.rows - c.y1).arg(c.x2 + 1).arg(config.rows - c.y2))) break;
+				ghosts.insert(Position(c.x3, c.y3));
+				continue;
+			}
 
 			removeList.push_back(Position(c.x1, c.y1));
 			removeList.push_back(Position(c.x2, c.y2));
@@ -371,26 +1167,30 @@ void loadFile(const QString &url, const ChipConfig &config, QVector<Droplet> &dr
 				iter.v
 			);
 
-			posMap[Position(c.x3, c.y3)] = count++; // Do not use putDroplet here
+			occupy(Position(c.x3, c.y3), count++); // Do not use putDroplet here
 
 			droplets.push_back(Droplet({iter, s}));
 
 			maxTime = std::max(maxTime, qint64(s.t * 1000));
 
-			sounds[s.t - soundOffset] |= sndFxMerge;
-			contaminants.push_back(Contaminant(c.t, count - 1, c.x3, c.y3));
+			timeline.addSounds(s.t - soundOffset, sndFxMerge);
+			timeline.addContaminant(c.t, count - 1, c.x3, c.y3);
 		} else if (c.type == CommandType::Splitting) {
 			maxTime = std::max(maxTime, c.t * qint64(1000));
 			qint32 id = findIdFromPosition(c.x1, c.y1);
 
 			if (id < 0 || id >= droplets.size()) {
-				error = ErrorLog(c.t, QString("%1: Cannot split at (%2, %3): no droplet here.").arg(c.t).arg(c.x1 + 1).arg(config.rows - c.y1));
-				break;
+				// A ghost splits at the Split step
+				if (!ghosts.contains(Position(c.x1, c.y1)) && !report(c.t, QString("%1: Cannot split at (%2, %3): no droplet here.").arg(c.t).arg(c.x1 + 1).arg(config.rows - c.y1))) break;
+				ghosts.insert(Position(c.x1, c.y1));
+				continue;
 			}
 
 			if (!checkPosition(c.x2, c.y2) || !checkPosition(c.x3, c.y3)) {
-				error = ErrorLog(c.t, QString("%1: Cannot split (%2, %3) to (%4, %5) and (%6, %7): Position out of grid").arg(c.t).arg(c.x1).arg(c.y1).arg(c.x2).arg(c.y2).arg(c.x3).arg(c.y3));
-				break;
+				if (!report(c.t, QString("%1: Cannot split (%2, %3) to (%4, %5) and (%6, %7): Position out of grid").arg(c.t).arg(c.x1).arg(c.y1).arg(c.x2).arg(c.y2).arg(c.x3).arg(c.y3))) break;
+				quarantine(id, c.t);
+				ghosts.insert(Position(c.x1, c.y1));
+				continue;
 			}
 
 			auto iter = droplets[id].back();
@@ -408,19 +1208,29 @@ void loadFile(const QString &url, const ChipConfig &config, QVector<Droplet> &dr
 
 			droplets[id].push_back(iter);
 
-			if (!putDroplet(c.x1, c.y1, id) || !putDroplet(c.x2, c.y2, id) || !putDroplet(c.x3, c.y3, id)) {
-				error = ErrorLog(c.t, QString("%1: Cannot split at (%2, %3): dynamic distance constraint failed.").arg(c.t).arg(c.x1 + 1).arg(config.rows - c.y1));
-				break;
+			// The halves must also keep apart from each other
+			bool apart = abs(c.x2 - c.x3) > 1 || abs(c.y2 - c.y3) > 1;
+			if (!apart || !putDroplet(c.x1, c.y1, id) || !putDroplet(c.x2, c.y2, id) || !putDroplet(c.x3, c.y3, id)) {
+				if (!report(c.t, QString("%1: Cannot split at (%2, %3): dynamic distance constraint failed.").arg(c.t).arg(c.x1 + 1).arg(config.rows - c.y1))) break;
+				quarantine(id, c.t);
+				ghosts.insert(Position(c.x1, c.y1));
+				continue;
 			}
 
 			droplets[id].push_back(s);
 
 			maxTime = std::max(maxTime, qint64(s.t * 1000));
-			sounds[s.t - soundOffset] |= sndFxSplitting;
+			timeline.addSounds(s.t - soundOffset, sndFxSplitting);
 		} else if (c.type == CommandType::Split) {
 			qint32 id = findIdFromPosition(c.x1, c.y1);
 
-			assert(id >= 0 && id < droplets.size());
+			if (id < 0) {
+				// Split twice, or split a ghost
+				if (!ghosts.remove(Position(c.x1, c.y1)) && !report(c.t - 1, QString("%1: Cannot split at (%2, %3): no droplet here.").arg(c.t - 1).arg(c.x1 + 1).arg(config.rows - c.y1))) break;
+				ghosts.insert(Position(c.x2, c.y2));
+				ghosts.insert(Position(c.x3, c.y3));
+				continue;
+			}
 
 			auto iter = droplets[id].back();
 			DropletStatus u(
@@ -430,9 +1240,9 @@ void loadFile(const QString &url, const ChipConfig &config, QVector<Droplet> &dr
 				radius,
 				radius,
 				iter.a,
-				randInt(0, 359),
-				iter.s <= 191 ? randInt(127, 2 * iter.s - 127) : randInt(2 * iter.s - 255, 255),
-				iter.v <= 191 ? randInt(127, 2 * iter.v - 127) : randInt(2 * iter.v - 255, 255)
+				random.randInt(0, 359),
+				iter.s <= 191 ? random.randInt(127, 2 * iter.s - 127) : random.randInt(2 * iter.s - 255, 255),
+				iter.v <= 191 ? random.randInt(127, 2 * iter.v - 127) : random.randInt(2 * iter.v - 255, 255)
 			), v(
 				c.t + 1,
 				c.x3,
@@ -458,31 +1268,179 @@ void loadFile(const QString &url, const ChipConfig &config, QVector<Droplet> &dr
 
 			maxTime = std::max(maxTime, qint64(u.t * 1000));
 
-			sounds[u.t - soundOffset] |= sndFxSplit;
-			contaminants.push_back(Contaminant(c.t + 1, nid1, c.x2, c.y2));
-			contaminants.push_back(Contaminant(c.t + 1, nid2, c.x3, c.y3));
+			timeline.addSounds(u.t - soundOffset, sndFxSplit);
+			timeline.addContaminant(c.t + 1, nid1, c.x2, c.y2);
+			timeline.addContaminant(c.t + 1, nid2, c.x3, c.y3);
 		}
+	}
+	next = i;
+	return true;
+}
 
-		if (i + 1 == commandList.size() || commandList[i + 1].t != commandList[i].t) {
-			for (qint32 i = 0; i < removeList.size(); ++i) {
-				removeDroplet(removeList[i].first, removeList[i].second);
-			}
-			removeList.clear();
+Command ProtocolLoader::pathStep(const PathStep &s) const {
+	const Command &mix = commandList[s.command];
+	qint32 k = 2 * (s.step - 1);
+	if (s.step == 1) {
+		return Command(CommandType::Mix, s.t, mix.x2, mix.y2, mix.path[0], mix.path[1]);
+	}
+	return Command(CommandType::Mix, s.t, mix.path[k - 2], mix.path[k - 1], mix.path[k], mix.path[k + 1]);
+}
+
+bool ProtocolLoader::later(const PathStep &a, const PathStep &b) const {
+	// A Repeat or a Call gives many commands the same line, which then keep the order of the list
+	qint32 lineA = commandLines[a.command], lineB = commandLines[b.command];
+	return a.t > b.t || (a.t == b.t && (lineA > lineB || (lineA == lineB && a.command > b.command)));
+}
+
+void ProtocolLoader::checkpoint(qint32 command) {
+	Checkpoint p(random, error);
+	p.command = command;
+	p.steps = steps;
+	p.posMap = posMap;
+	p.ghosts = ghosts;
+	p.count = count;
+	p.minTime = minTime;
+	p.maxTime = maxTime;
+	p.errors = errors.size();
+	p.droplets = droplets.size();
+	p.events = timeline.size();
+	// Only droplets on the chip get new states later
+	for (auto it = posMap.begin(); it != posMap.end(); ++it) {
+		p.tracks.push_back(QPair<qint32, qint32>(it.value(), droplets[it.value()].size()));
+	}
+	checkpoints.push_back(p);
+}
+
+void ProtocolLoader::restore(const Checkpoint &p) {
+	posMap = p.posMap;
+	occupied = CellMask(config.rows, config.columns);
+	for (auto it = posMap.constBegin(); it != posMap.constEnd(); ++it) {
+		if (it.key().first >= 0 && it.key().first < config.columns && it.key().second >= 0 && it.key().second < config.rows) {
+			occupied.set(it.key().first, it.key().second);
 		}
 	}
+	ghosts = p.ghosts;
+	removeList.clear();
+	steps = p.steps;
+	second = noSecond;
+	random = p.random;
+	count = p.count;
+	minTime = p.minTime;
+	maxTime = p.maxTime;
+	error = p.error;
+	errors.remove(p.errors, errors.size() - p.errors);
+	droplets.resize(p.droplets);
+	for (const QPair<qint32, qint32> &track : p.tracks) {
+		droplets[track.first].resize(track.second);
+	}
+	timeline.truncate(p.events);
+}
 
-	sounds[inf] = sndFxMove;
+bool ProtocolLoader::sameCommand(const Command &a, const Command &b) {
+	return a.type == b.type && a.t == b.t && a.x1 == b.x1 && a.y1 == b.y1 && a.x2 == b.x2 && a.y2 == b.y2 && a.x3 == b.x3 && a.y3 == b.y3 && a.path == b.path;
+}
 
-	qint32 timeMaximum = commandList.back().t + 1;
-	for (qint32 i = 0; i < droplets.size(); ++i) {
-		DropletStatus last = droplets[i].back();
-		if (fabs(last.rx - radius) < eps && fabs(last.ry - radius) < eps) {
-			last.t = timeMaximum;
-			droplets[i].push_back(last); // Push a final state so that status is keeped when error occurs
+void loadFile(const QString &url, const ChipConfig &config, QVector<Droplet> &droplets, qint64 &minTime, qint64 &maxTime, Timeline &timeline, ErrorLog &error, quint64 seed, ErrorList *errors) {
+	ProtocolLoader loader;
+	loader.load(url, config, seed, errors != nullptr);
+	loader.result(droplets, minTime, maxTime, timeline, error, errors);
+}
+
+const char portCharacters[] = ".iowx"; // by PortType
+
+bool loadChipConfig(const QString &url, ChipConfig &config, QString &message) {
+	QFile file(url);
+	if (!file.open(QFile::ReadOnly | QFile::Text)) {
+		message = QString("Cannot open %1.").arg(url);
+		return false;
+	}
+	QTextStream fs(&file);
+
+	config.init();
+	QMap<QString, QVector<PortType> *> sides;
+	qint32 line = 0, count[5] = {0, 0, 0, 0, 0};
+	while (!fs.atEnd()) {
+		++line;
+		QStringList tokens = fs.readLine().simplified().split(' ', QString::SkipEmptyParts);
+		if (tokens.empty() || tokens[0].startsWith('#')) continue;
+
+		QString key = tokens[0].toLower();
+		if (key == "chip") {
+			if (tokens.size() != 3) {
+				message = QString("Line %1: expected \"Chip rows columns\".").arg(line);
+				return false;
+			}
+			config.init(tokens[1].toInt(), tokens[2].toInt());
+			if (!config.valid) {
+				message = QString("Line %1: a chip has 3 to %2 rows and columns, and more than 3 x 3 cells.").arg(line).arg(maxChipSize);
+				return false;
+			}
+			sides["l"] = &config.L;
+			sides["t"] = &config.T;
+			sides["r"] = &config.R;
+			sides["b"] = &config.B;
+		} else if (sides.count(key)) {
+			QVector<PortType> &side = *sides[key];
+			if (tokens.size() != 2 || tokens[1].size() != side.size()) {
+				message = QString("Line %1: side %2 needs one character per cell, %3 in all.").arg(line).arg(tokens[0]).arg(side.size());
+				return false;
+			}
+			for (qint32 i = 0; i < side.size(); ++i) {
+				qint32 T = QString(portCharacters).indexOf(tokens[1][i].toLower());
+				if (T < 0) {
+					message = QString("Line %1: unknown port '%2'.").arg(line).arg(tokens[1][i]);
+					return false;
+				}
+				side[i] = PortType(T);
+				++count[side[i]];
+			}
+			sides.remove(key);
+		} else if (key == "l" || key == "t" || key == "r" || key == "b") {
+			message = QString("Line %1: side %2 comes before the size of the chip or twice.").arg(line).arg(tokens[0]);
+			return false;
+		} else {
+			message = QString("Line %1: unknown entry \"%2\".").arg(line).arg(tokens[0]);
+			return false;
 		}
 	}
 
-	std::sort(contaminants.begin(), contaminants.end(), [](Contaminant a, Contaminant b) -> bool { return a.time < b.time; });
+	if (!config.valid) {
+		message = QString("The size of the chip is missing.");
+		return false;
+	}
+	if (count[PortType::input] == 0 || count[PortType::output] == 0) {
+		message = QString("A chip needs at least one input and one output port.");
+		return false;
+	}
+	if ((count[PortType::wash] == 0) != (count[PortType::waste] == 0)) {
+		message = QString("Wash and waste ports come together.");
+		return false;
+	}
+	config.hasWash = count[PortType::wash] > 0;
+	return true;
+}
+
+bool saveChipConfig(const QString &url, const ChipConfig &config, QString &message) {
+	QFile file(url);
+	if (!file.open(QFile::WriteOnly | QFile::Text)) {
+		message = QString("Cannot write %1.").arg(url);
+		return false;
+	}
+	QTextStream fs(&file);
+
+	auto side = [](const QVector<PortType> &ports) -> QString {
+		QString text;
+		for (PortType T : ports) {
+			text += QChar(portCharacters[T]);
+		}
+		return text;
+	};
+	fs << "Chip " << config.rows << " " << config.columns << "\n";
+	fs << "L " << side(config.L) << "\n";
+	fs << "T " << side(config.T) << "\n";
+	fs << "R " << side(config.R) << "\n";
+	fs << "B " << side(config.B) << "\n";
+	return true;
 }
 
 void moveToPort(qint32 &x, qint32 &y, const ChipConfig &config) {
@@ -498,6 +1456,9 @@ void moveToPort(qint32 &x, qint32 &y, const ChipConfig &config) {
 }
 
 bool isPortType(qint32 x, qint32  y, const ChipConfig &config, PortType T) {
+	if (x < 0 || x >= config.columns || y < 0 || y >= config.rows) {
+		return false;
+	}
 	if (x > 0 && x + 1 < config.columns && y > 0 && y + 1 < config.rows) {
 		return false;
 	}
@@ -526,6 +1487,150 @@ bool getRealTimeStatus(const Droplet &d, qreal t, DropletStatus &ans, qreal &x,
 	return true;
 }
 
+void fastForward(const ChipConfig &config, const Timeline &timeline, qint64 maxTime, ContaminationMap &contamination, ContaminationSummary &summary) {
+	contamination.clear();
+	contamination.resize(config.columns);
+	for (qint32 i = 0; i < config.columns; ++i) {
+		contamination[i].resize(config.rows);
+	}
+
+	// events are sorted by tick, so we can stop at the first one beyond maxTime
+	qint32 end = timeline.upperBound(maxTime * ticksPerSecond / 1000);
+	for (qint32 i = 0; i < end; ++i) {
+		if (timeline.type(i) == EventType::ContaminantEvent) {
+			const Contaminant &c = timeline.contaminant(i);
+			contamination[c.x][c.y].insert(c.id);
+		} else if (timeline.type(i) == EventType::WashEvent) {
+			const Position &p = timeline.wash(i);
+			contamination[p.first][p.second].clear();
+		}
+	}
+
+	summary = summarizeContamination(contamination);
+	summary.errorTime = timeline.errorTime();
+}
+
+ContaminationSummary summarizeContamination(const ContaminationMap &contamination) {
+	ContaminationSummary summary;
+	for (qint32 x = 0; x < contamination.size(); ++x) {
+		for (qint32 y = 0; y < contamination[x].size(); ++y) {
+			qint32 count = contamination[x][y].size();
+			if (count > 0) {
+				++summary.cells;
+				summary.residues += count;
+				summary.maxResidues = std::max(summary.maxResidues, count);
+			}
+		}
+	}
+	return summary;
+}
+
+void futureOccupancy(const ChipConfig &config, const QVector<Droplet> &droplets, qreal time, ContaminationMap &occupancy) {
+	occupancy.clear();
+	occupancy.resize(config.columns);
+	for (qint32 i = 0; i < config.columns; ++i) {
+		occupancy[i].resize(config.rows);
+	}
+
+	for (qint32 i = 0; i < droplets.size(); ++i) {
+		for (const DropletStatus &s : droplets[i]) {
+			if (s.t <= time + eps) continue; // already reached
+			for (qint32 x = qint32(ceil(s.x - s.rx)); x <= qint32(floor(s.x + s.rx)); ++x) {
+				for (qint32 y = qint32(ceil(s.y - s.ry)); y <= qint32(floor(s.y + s.ry)); ++y) {
+					if (x >= 0 && x < config.columns && y >= 0 && y < config.rows) {
+						occupancy[x][y].insert(i);
+					}
+				}
+			}
+		}
+	}
+}
+
+QVector<Position> demandedCells(const ContaminationMap &contamination, const ContaminationMap &occupancy) {
+	QVector<Position> cells;
+	for (qint32 x = 0; x < contamination.size(); ++x) {
+		for (qint32 y = 0; y < contamination[x].size(); ++y) {
+			const QSet<qint32> &residues = contamination[x][y], &visitors = occupancy[x][y];
+			// A cell needs washing unless every residue on it belongs to the only droplet passing it
+			if (residues.empty() || visitors.empty()) continue;
+			if (visitors.size() == 1 && residues.size() == 1 && residues.contains(*visitors.begin())) continue;
+			cells.push_back(Position(x, y));
+		}
+	}
+	return cells;
+}
+
+QVector<WashDemand> washDemands(const ChipConfig &config, const QVector<Droplet> &droplets, const Timeline &timeline, const ContaminationMap &contamination, qreal time) {
+	struct CellEvent {
+		qint32 time, id;
+		bool arrival; // a droplet arrives, otherwise it leaves residue
+	};
+	qint32 R = config.rows, C = config.columns;
+	QVector<QVector<CellEvent>> events(C * R);
+
+	// Residues from the remaining contaminant events
+	for (qint32 i = timeline.upperBound(Timeline::toTick(time)); i < timeline.size(); ++i) {
+		if (timeline.type(i) == EventType::ContaminantEvent) {
+			const Contaminant &c = timeline.contaminant(i);
+			events[c.x * R + c.y].push_back({c.time, c.id, false});
+		}
+	}
+
+	// Arrivals from the remaining keyframes: cells covered by a keyframe but not by the one before
+	auto covers = [](const DropletStatus &s, qint32 x, qint32 y) -> bool {
+		return x >= qint32(ceil(s.x - s.rx)) && x <= qint32(floor(s.x + s.rx)) && y >= qint32(ceil(s.y - s.ry)) && y <= qint32(floor(s.y + s.ry));
+	};
+	for (qint32 i = 0; i < droplets.size(); ++i) {
+		for (qint32 k = 1; k < droplets[i].size(); ++k) {
+			const DropletStatus &s = droplets[i][k];
+			if (s.t <= time + eps) continue;
+			for (qint32 x = qint32(ceil(s.x - s.rx)); x <= qint32(floor(s.x + s.rx)); ++x) {
+				for (qint32 y = qint32(ceil(s.y - s.ry)); y <= qint32(floor(s.y + s.ry)); ++y) {
+					if (x >= 0 && x < C && y >= 0 && y < R && !covers(droplets[i][k - 1], x, y)) {
+						events[x * R + y].push_back({qint32(floor(s.t)), i, true});
+					}
+				}
+			}
+		}
+	}
+
+	// Replay each cell; residues of other droplets must be gone before an arrival
+	QVector<WashDemand> demands;
+	qint32 now = qint32(ceil(time - eps));
+	for (qint32 cell = 0; cell < events.size(); ++cell) {
+		qint32 x = cell / R, y = cell % R;
+		QVector<CellEvent> &list = events[cell];
+		std::stable_sort(list.begin(), list.end(), [](const CellEvent &a, const CellEvent &b) -> bool {
+			return a.time < b.time || (a.time == b.time && a.arrival && !b.arrival);
+		});
+
+		QMap<qint32, qint32> dirty; // droplet id -> second its residue was left
+		for (qint32 id : contamination[x][y]) {
+			dirty[id] = now;
+		}
+		for (const CellEvent &e : list) {
+			if (!e.arrival) {
+				dirty[e.id] = e.time;
+				continue;
+			}
+			bool foreign = false;
+			qint32 release = now;
+			for (auto iter = dirty.constBegin(); iter != dirty.constEnd(); ++iter) {
+				if (iter.key() != e.id) {
+					foreign = true;
+					release = std::max(release, iter.value());
+				}
+			}
+			// Regarded as washed from here on; without time to wash before the arrival, the residues stay for the next one
+			if (foreign && release < e.time) {
+				demands.push_back(WashDemand(x, y, release, e.time));
+				dirty.clear();
+			}
+		}
+	}
+	return demands;
+}
+
 qreal easing(qreal t) {
 	if (t < 0.5) {
 		return pow(t * 2.0, 3.0) / 2.0;
@@ -534,17 +1639,29 @@ qreal easing(qreal t) {
 	}
 }
 
-qint32 randInt(qint32 L, qint32 R) {
+Random::Random(quint64 seed, quint64 stream) : state(mix(seed ^ mix(stream))) {}
+
+quint64 Random::next() {
+	state += quint64(0x9e3779b97f4a7c15ull);
+	return mix(state);
+}
+
+qint32 Random::randInt(qint32 L, qint32 R) {
 	if (L > R) {
 		std::swap(L, R);
 	}
-	qint32 ans = qint32(rand() / qreal(RAND_MAX) * (R - L + 1) + L - 0.5);
-	return ans;
+	return L + qint32(next() % quint64(qint64(R) - L + 1));
 }
 
-qreal randReal(qreal L, qreal R) {
+qreal Random::randReal(qreal L, qreal R) {
 	if (L > R) {
 		std::swap(L, R);
 	}
-	return rand() / qreal(RAND_MAX) * (R - L) + L;
+	return (next() >> 11) * (1.0 / 9007199254740992.0) * (R - L) + L; // 53 random bits in [0, 1)
+}
+
+quint64 Random::mix(quint64 key) {
+	key = (key ^ (key >> 30)) * quint64(0xbf58476d1ce4e5b9ull);
+	key = (key ^ (key >> 27)) * quint64(0x94d049bb133111ebull);
+	return key ^ (key >> 31);
 }
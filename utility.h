@@ -2,25 +2,37 @@
 #define UTILITY_H
 
 #include <cmath>
+#include <limits>
 #include <utility>
+#include <functional>
 
 #include <QMap>
+#include <QSet>
 #include <QColor>
 #include <QVector>
+#include <QByteArray>
 #include <QMessageBox>
 #include <QIntegerForSize>
 
+#include "expander.h"
+
 extern const qreal eps;
 extern const qreal inf;
 
+extern const qint32 maxChipSize; // rows or columns
+
 extern const qreal radius;
 extern const qreal rContaminant;
 extern const qint32 contaminationDots;
 
 extern const qreal runAcceleration;
 extern const qreal washAcceleration;
+extern const qint32 maxWashDroplets;
+
+extern const qint32 ticksPerSecond;
 
 extern const qreal soundOffset;
+extern const qint32 soundLookahead; // in milliseconds
 extern const qreal mergingTimeInterval;
 extern const qreal splitStretchInterval;
 
@@ -28,6 +40,11 @@ extern const qint32 sndFxMove;
 extern const qint32 sndFxMerge;
 extern const qint32 sndFxSplitting;
 extern const qint32 sndFxSplit;
+extern const qint32 sndFxError;
+
+extern const quint64 streamDroplets; // random streams of a loaded file
+extern const quint64 streamWash;
+extern const quint64 streamContaminants; // first stream of the contamination dots, one per cell
 
 extern const qint32 dirX[8];
 extern const qint32 dirY[8];
@@ -43,6 +60,10 @@ enum CommandType {
 	Merging, Merged, Splitting, Split
 };
 
+enum EventType {
+	SoundEvent, ContaminantEvent, ErrorEvent, WashEvent
+};
+
 enum PortType {
 	none, input, output, wash, waste
 };
@@ -73,6 +94,7 @@ struct DropletStatus {
 struct Command {
 	CommandType type;
 	qint32 t, x1, y1, x2, y2, x3, y3;
+	QVector<qint32> path; // Mix: x and y of the cells after (x2, y2), one per second
 	Command(CommandType type, qint32 t, qint32 x1, qint32 y1, qint32 x2 = -1, qint32 y2 = -1, qint32 x3 = -1, qint32 y3 = -1);
 };
 
@@ -83,13 +105,131 @@ struct ErrorLog {
 };
 
 typedef QVector<Contaminant> ContaminantList;
+typedef QVector<ErrorLog> ErrorList;
 typedef QVector<DropletStatus> Droplet;
-typedef QMap<qreal, qint32> SoundList;
 typedef std::pair<qint32, qint32> Position;
+typedef QVector<QVector<QSet<qint32>>> ContaminationMap;
+
+struct ContaminationSummary {
+	qint32 cells; // number of contaminated cells
+	qint32 residues; // total number of (cell, droplet) residues
+	qint32 maxResidues; // largest number of residues on a single cell
+	qint32 errorTime; // moment of the error, or -2 if the protocol is valid
+	ContaminationSummary();
+};
+
+// Packed bit grid with one bit per cell, stored column by column in 64-bit words
+class CellMask {
+public:
+	CellMask(qint32 rows = 0, qint32 columns = 0);
+
+	qint32 rows() const;
+	qint32 columns() const;
+	bool isNull() const;
+
+	bool test(qint32 x, qint32 y) const;
+	void set(qint32 x, qint32 y, bool value = true);
+	void setRect(qint32 x0, qint32 y0, qint32 x1, qint32 y1); // inclusive, clipped to the grid
+
+	CellMask dilated() const; // every cell within Chebyshev distance 1 of a set cell
+	CellMask &operator|=(const CellMask &other);
+	bool operator==(const CellMask &other) const;
+	bool operator!=(const CellMask &other) const;
+
+	QByteArray toByteArray() const;
+
+private:
+	qint32 R, C;
+	qint32 stride; // words per column
+	QVector<quint64> words;
+};
+
+// Space-time occupancy of a loaded protocol: for every cell, the sorted and disjoint runs of seconds during which
+// a droplet covers it, or is within distance 1 of it. Between two keyframes a droplet may be anywhere on the cells
+// covered by either of them. Queries binary-search the runs of one cell.
+class OccupancyIndex {
+public:
+	OccupancyIndex();
+
+	void build(const ChipConfig &config, const QVector<Droplet> &droplets);
+
+	qint32 rows() const;
+	qint32 columns() const;
+	qint32 horizon() const; // one past the last second at which some cell is near a droplet
+
+	bool occupied(qint32 x, qint32 y, qint32 t) const;
+	bool occupiedDuring(qint32 x, qint32 y, qint32 t0, qint32 t1) const; // at some second within [t0, t1]
+	bool near(qint32 x, qint32 y, qint32 t) const; // within distance 1 of a droplet
+	bool nearDuring(qint32 x, qint32 y, qint32 t0, qint32 t1) const;
+	qint32 nextFree(qint32 x, qint32 y, qint32 t) const; // first second from t on at which the cell is not near a droplet
+
+private:
+	typedef QVector<QVector<Position>> Intervals; // (first, last) seconds by cell
+
+	// Runs of cell c are begins[i] .. ends[i] for i within [offsets[c], offsets[c + 1])
+	struct Runs {
+		QVector<qint32> offsets, begins, ends;
+	};
+
+	static Runs compress(Intervals &intervals);
+	qint32 find(const Runs &runs, qint32 x, qint32 y, qint32 t) const; // first run of the cell ending at t or later
+	bool overlaps(const Runs &runs, qint32 x, qint32 y, qint32 t0, qint32 t1) const;
+
+	qint32 R, C;
+	qint32 last;
+	Runs cover, halo;
+};
+
+struct WashDemand {
+	qint32 x, y;
+	qint32 release; // second from which residue of another droplet lies on the cell
+	qint32 deadline; // second at which the next droplet arrives
+	WashDemand(qint32 x, qint32 y, qint32 release, qint32 deadline);
+};
+
+// Sound, contaminant, error and wash events of a protocol, stored in flat arrays sorted by integer ticks
+class Timeline {
+public:
+	void clear();
+	void addSounds(qreal time, qint32 sounds);
+	void addContaminant(qint32 time, qint32 id, qint32 x, qint32 y);
+	void addError(qint32 time);
+	void addWash(qint32 time, qint32 x, qint32 y);
+	void removeWashes(qint64 after); // drop the wash events after the tick
+	void truncate(qint32 size); // drop the events from index size on, before finalize
+	void finalize(); // sort events by tick and coalesce sounds of the same tick
+	void finalizeFrom(qint32 from); // the same for the events added since the others were finalized
+
+	qint32 size() const;
+	qint32 upperBound(qint64 tick) const; // index of the first event after the tick
+	qint64 tick(qint32 i) const;
+	EventType type(qint32 i) const;
+	qint32 sounds(qint32 i) const;
+	const Contaminant &contaminant(qint32 i) const;
+	const Position &wash(qint32 i) const;
+	qint32 errorTime() const; // moment of the first error, or -2 if there is none
+
+	static qint64 toTick(qreal time);
+
+private:
+	QVector<qint64> ticks;
+	QVector<EventType> types;
+	QVector<qint32> payloads; // sound mask, or index into contaminants or washes
+	ContaminantList contaminants;
+	QVector<Position> washes;
+};
 
 DropletStatus interpolation(DropletStatus a, DropletStatus b, qreal t, qreal &x, qreal &y);
 
-void loadFile(const QString &url, const ChipConfig &config, QVector<Droplet> &droplets, qint64 &minTime, qint64 &maxTime, SoundList &sounds, ErrorLog &error, ContaminantList &contaminants);
+// Chip configuration files: a line "Chip rows columns", then one line per side (L, T, R and B) listing a character per
+// cell, from top to bottom or from left to right: '.' for none, 'i' for input, 'o' for output, 'w' for wash, 'x' for waste
+bool loadChipConfig(const QString &url, ChipConfig &config, QString &message);
+bool saveChipConfig(const QString &url, const ChipConfig &config, QString &message);
+
+// Droplet colours are drawn from stream streamDroplets of the seed. Loading stops at the first error, unless errors is
+// given: then the droplet of a failed command is dropped, loading goes on, and every error is listed in the order of time.
+// The timeline and error only ever hold the first error.
+void loadFile(const QString &url, const ChipConfig &config, QVector<Droplet> &droplets, qint64 &minTime, qint64 &maxTime, Timeline &timeline, ErrorLog &error, quint64 seed = 0, ErrorList *errors = nullptr);
 
 void moveToPort(qint32 &x, qint32 &y, const ChipConfig &config);
 
@@ -97,11 +237,146 @@ bool isPortType(qint32 x, qint32 y, const ChipConfig &config, PortType T);
 
 bool getRealTimeStatus(const Droplet &d, qreal time, DropletStatus &ans, qreal &x, qreal &y);
 
+// Compute the contamination on the chip at moment maxTime (in milliseconds) in a single pass over the timeline
+void fastForward(const ChipConfig &config, const Timeline &timeline, qint64 maxTime, ContaminationMap &contamination, ContaminationSummary &summary);
+
+ContaminationSummary summarizeContamination(const ContaminationMap &contamination);
+
+// Collect the ids of the droplets which will occupy each cell after the given moment, from their remaining keyframes
+void futureOccupancy(const ChipConfig &config, const QVector<Droplet> &droplets, qreal time, ContaminationMap &occupancy);
+
+// Contaminated cells which a droplet other than the ones that left the residue is going to pass
+QVector<Position> demandedCells(const ContaminationMap &contamination, const ContaminationMap &occupancy);
+
+// Cells which must be washed between a residue and the arrival of a different droplet, from the given moment on
+QVector<WashDemand> washDemands(const ChipConfig &config, const QVector<Droplet> &droplets, const Timeline &timeline, const ContaminationMap &contamination, qreal time);
+
 qreal easing(qreal t);
 
-// Random integer within interval [L, R], both L and R included
-qint32 randInt(qint32 L, qint32 R);
+// Splitmix64 generator. Each user owns one, seeded with the seed of the file and a stream of its own,
+// so colours and dots are the same for the same seed and no state is shared between threads.
+class Random {
+public:
+	explicit Random(quint64 seed, quint64 stream = 0);
+
+	quint64 next();
+
+	// Random integer within interval [L, R], both L and R included
+	qint32 randInt(qint32 L, qint32 R);
 
-qreal randReal(qreal L, qreal R);
+	qreal randReal(qreal L, qreal R);
+
+	static quint64 mix(quint64 key); // finalizer of splitmix64, a bijection on 64-bit keys
+
+private:
+	quint64 state;
+};
+
+// Loads command files like loadFile, taking checkpoints of the simulation every few seconds. After the file is changed,
+// reload parses again only the lines between the beginning and the end the old and new files share, and simulates
+// again only from the last checkpoint before the first command that differs.
+class ProtocolLoader {
+public:
+	ProtocolLoader();
+
+	// Called every few hundred lines while parsing, then every few hundred commands while simulating; loading stops
+	// when it returns false
+	typedef std::function<bool(qint64 bytes, qint64 totalBytes, qint32 commands, qint32 totalCommands)> Progress;
+
+	bool load(const QString &url, const ChipConfig &config, quint64 seed, bool recover, const Progress &progress = Progress()); // false if stopped
+	// Reads the file of the last load, and the files it includes, again; false if its commands are the same, or if stopped,
+	// which leaves the loader half updated
+	bool reload(const Progress &progress = Progress());
+	qint32 resumeTime() const; // second the last simulation started from
+	QStringList files() const; // the file of the last load, then the files it includes
+
+	void result(QVector<Droplet> &droplets, qint64 &minTime, qint64 &maxTime, Timeline &timeline, ErrorLog &error, ErrorList *errors = nullptr) const;
+
+	// Live input: commands come one by one in the order of time, from second 0 on, and each is simulated as it comes.
+	// The droplets and the timeline are swapped in and out by the caller around every batch, so neither is ever copied.
+	void startLive(const ChipConfig &config, quint64 seed, bool recover);
+	bool append(const CommandRecord &record, QString &message); // false if refused for coming too late
+	void endLive(); // the Mixes going on take the rest of their steps
+	qint32 liveTime() const; // the protocol only changes from this second on
+	void exchange(QVector<Droplet> &droplets, Timeline &timeline); // swaps them with those of the loader
+	void liveResult(qint64 &minTime, qint64 &maxTime, ErrorLog &error, ErrorList &errors) const; // adds the errors after those in errors
+
+private:
+	// Step of a Mix after its first, taken in the order of time, then of the line of the Mix
+	struct PathStep {
+		qint32 t, command, step;
+	};
+
+	struct Checkpoint {
+		qint32 command; // first command simulated after the checkpoint, which starts a second
+		QVector<PathStep> steps;
+		QMap<Position, qint32> posMap;
+		QSet<Position> ghosts;
+		Random random;
+		qint32 count;
+		qint64 minTime, maxTime;
+		ErrorLog error;
+		qint32 errors, droplets, events; // sizes of the lists, which only grow
+		QVector<QPair<qint32, qint32>> tracks; // length of the track of every droplet on the chip
+		Checkpoint(const Random &random, const ErrorLog &error) : random(random), error(error) {}
+	};
+
+	static const qint32 checkpointInterval = 1024; // commands
+	static const qint32 progressInterval = 256; // lines or commands
+	static const qint32 expansionProgressInterval = 4096; // commands made by directives
+	static const qint32 noSecond = std::numeric_limits<qint32>::min();
+
+	bool readText(QByteArray &text, QString &message) const;
+	// Of the text from line on; false if stopped, or with a message if the directives cannot be expanded
+	bool parse(qint32 begin, qint32 end, qint32 line, CommandExpander &expander, QVector<Command> &commands, QVector<qint32> &lines, QString &message, const Progress &progress = Progress()) const;
+	void addCommand(const CommandRecord &record, QVector<Command> &commands) const;
+	// The commands after a change of the text, from the lines that changed; false if it has to be parsed as a whole
+	bool reparse(const QByteArray &old, QVector<Command> &commands, QVector<qint32> &lines) const;
+	static void sortCommands(QVector<Command> &commands, QVector<qint32> &lines);
+	Command pathStep(const PathStep &s) const;
+	bool later(const PathStep &a, const PathStep &b) const;
+	void reset();
+	// Commands and steps from command from on, up to second until
+	bool simulate(qint32 from, const Progress &progress = Progress(), qint32 until = std::numeric_limits<qint32>::max());
+	void simulateLive(qint32 until);
+	qint32 lastSecond() const;
+	void checkpoint(qint32 command);
+	void restore(const Checkpoint &p);
+	static bool sameCommand(const Command &a, const Command &b);
+
+	QString url;
+	ChipConfig config;
+	quint64 seed;
+	bool recover;
+	bool live; // commands come from append, and are never simulated again
+	QByteArray text;
+	bool extended; // whether the text has directives, which make every reload parse the whole of it
+	QStringList includes;
+	QString parseError; // the file is not simulated if set
+	QVector<Command> commandList; // in the order of time, then of the file
+	QVector<qint32> commandLines; // line of every command
+
+	// State of the simulation. When recovering, a droplet whose command failed fades out, and a ghost takes up
+	// its later commands silently, so that an error is not repeated for every command of the same droplet
+	QMap<Position, qint32> posMap;
+	CellMask occupied; // the cells of posMap on the chip, which the distance constraints test before posMap
+	QSet<Position> ghosts;
+	QVector<Position> removeList; // cells left during the current second
+	QVector<PathStep> steps; // next steps of the Mixes going on, a heap by later
+	qint32 next; // first command not simulated yet
+	qint32 second; // of the last command or step simulated, noSecond before the first
+	qint32 frontier; // live input: second of the last command
+	QVector<qint32> held; // live input: droplets given a last state at the frontier
+	Random random;
+	qint32 count;
+	QVector<Droplet> droplets;
+	Timeline timeline; // not finalized
+	qint64 minTime, maxTime;
+	ErrorLog error;
+	ErrorList errors;
+
+	QVector<Checkpoint> checkpoints; // only the first one while live
+	qint32 resumed; // checkpoint the last simulation started from
+};
 
 #endif // UTILITY_H
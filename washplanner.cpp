@@ -0,0 +1,629 @@
+#include "washplanner.h"
+
+#include <QHash>
+#include <QElapsedTimer>
+
+static const qint32 orOptSegment = 3; // longest segment moved by Or-opt
+static const qint32 cacheCapacity = 64; // number of plans kept by the route cache
+
+// Position just outside the chip at the port of a border cell
+static Position outside(qint32 cell, qint32 rows, const ChipConfig &config) {
+	qint32 x = cell / rows, y = cell % rows;
+	moveToPort(x, y, config);
+	return Position(x, y);
+}
+
+WashPlanner::WashPlanner(qint32 budget) : budget(budget), rows(0), columns(0), length(0) {}
+
+WashPlanner::Result WashPlanner::plan(const ChipConfig &config, const CellMask &obstacles, const QVector<Position> &targets, QVector<Position> &steps) {
+	length = 0;
+	steps.clear();
+
+	// Step 1: find [wash input] and [waste] ports
+	if (!prepare(config, obstacles)) {
+		return NoRoute;
+	}
+
+	// Step 2: collect reachable targets; multi-source BFS gives the distance from the nearest port of each kind
+	QVector<qint32> fromSources, toSinks;
+	bfs(sources, fromSources);
+	bfs(sinks, toSinks);
+	if (nearest(sources, toSinks) < 0) {
+		return NoRoute;
+	}
+
+	CellMask wanted(rows, columns);
+	bool nothing = true;
+	for (qint32 i = 0; i < targets.size(); ++i) {
+		qint32 cell = targets[i].first * rows + targets[i].second;
+		if (fromSources[cell] < 0 || toSinks[cell] < 0) continue; // unreachable, cannot be washed
+		nothing = false;
+		// A lone wash or waste port is always where the tour enters or leaves; of several, the tour may not use some
+		bool end = (sources.size() == 1 && sources[0] == cell) || (sinks.size() == 1 && sinks[0] == cell);
+		wanted.set(targets[i].first, targets[i].second, !end);
+	}
+	if (nothing) {
+		return NothingToWash;
+	}
+
+	// The same obstacles and targets always give the same plan
+	key.clear();
+	key.append(reinterpret_cast<const char *>(&rows), sizeof(rows));
+	key.append(reinterpret_cast<const char *>(&columns), sizeof(columns));
+	key.append(reinterpret_cast<const char *>(sources.constData()), sources.size() * qint32(sizeof(qint32)));
+	key.append('/');
+	key.append(reinterpret_cast<const char *>(sinks.constData()), sinks.size() * qint32(sizeof(qint32)));
+	key.append(blocked.toByteArray());
+	key.append(wanted.toByteArray());
+	auto iter = cache.constFind(key);
+	if (iter != cache.constEnd()) {
+		nodes = iter->nodes;
+		order = iter->order;
+		matrix = iter->matrix;
+		steps = iter->steps;
+		length = steps.size() - 1;
+		lastTour = orderedCells();
+		return Planned;
+	}
+
+	// The ends of the tour stand for the sets of wash and waste ports until the tour is known
+	nodes.clear();
+	nodes.push_back(-1);
+	for (qint32 cell = 0; cell < rows * columns; ++cell) {
+		if (wanted.test(cell / rows, cell % rows)) {
+			nodes.push_back(cell);
+		}
+	}
+	nodes.push_back(-1);
+
+	// Step 3: distances between all nodes
+	qint32 n = nodes.size();
+	field.resize(n);
+	field[0] = fromSources;
+	field[n - 1] = toSinks;
+	for (qint32 i = 1; i + 1 < n; ++i) {
+		field[i] = distanceField(nodes[i]);
+	}
+	qint32 direct = toSinks[nearest(sources, toSinks)]; // from the wash ports straight to the waste ports
+	matrix.resize(n * n);
+	for (qint32 i = 0; i < n; ++i) {
+		for (qint32 j = 0; j < n; ++j) {
+			qint32 a = std::min(i, j), b = std::max(i, j);
+			if (a == b) {
+				matrix[i * n + j] = 0;
+			} else if (a == 0 && b == n - 1) {
+				matrix[i * n + j] = direct;
+			} else if (a == 0 || b == n - 1) {
+				matrix[i * n + j] = field[a == 0 ? a : b][nodes[a == 0 ? b : a]];
+			} else {
+				matrix[i * n + j] = field[a][nodes[b]];
+			}
+		}
+	}
+
+	// Step 4: visiting order, starting from the previous tour when only a few targets changed
+	QVector<qint32> &tour = order;
+	if (!repairTour(tour)) {
+		nearestNeighbour(tour);
+	}
+
+	QElapsedTimer timer;
+	timer.start();
+	while (timer.elapsed() < budget && (twoOpt(tour) || orOpt(tour))) {}
+
+	// Step 5: expand the tour into single steps, entering through the wash port nearest to the first target;
+	// walking down the distance field of the waste ports ends at the nearest one
+	nodes[0] = nearest(sources, field[tour[1]]);
+	steps.push_back(outside(nodes[0], rows, config));
+	steps.push_back(Position(nodes[0] / rows, nodes[0] % rows));
+	for (qint32 i = 0; i + 1 < n; ++i) {
+		appendPath(tour[i], tour[i + 1], steps);
+	}
+	nodes[n - 1] = steps.back().first * rows + steps.back().second;
+	steps.push_back(outside(nodes[n - 1], rows, config));
+
+	length = steps.size() - 1;
+	lastTour = orderedCells();
+
+	if (cache.size() >= cacheCapacity) {
+		cache.clear();
+	}
+	CachedPlan &entry = cache[key];
+	entry.nodes = nodes;
+	entry.order = order;
+	entry.matrix = matrix;
+	entry.steps = steps;
+	return Planned;
+}
+
+WashPlanner::Result WashPlanner::planFleet(const ChipConfig &config, const CellMask &obstacles, const QVector<Position> &targets, qint32 count, QVector<QVector<Position>> &routes) {
+	routes.clear();
+
+	QVector<Position> steps;
+	Result result = plan(config, obstacles, targets, steps);
+	if (result != Planned || count <= 1) {
+		if (result == Planned) {
+			routes.push_back(steps);
+		}
+		return result;
+	}
+
+	// Step 1: cut the tour into pieces of similar length
+	qint32 n = nodes.size();
+	if (n <= 2) {
+		routes.push_back(steps);
+		return result;
+	}
+	QVector<qint32> prefix(n, 0);
+	for (qint32 i = 1; i < n; ++i) {
+		prefix[i] = prefix[i - 1] + matrix[order[i - 1] * n + order[i]];
+	}
+	auto iter = cache.find(key);
+	if (iter != cache.end() && iter->fleets.contains(count)) {
+		routes = iter->fleets[count];
+		length = routes[0].size() - 1;
+		return Planned;
+	}
+
+	QVector<QVector<qint32>> pieces(count);
+	for (qint32 i = 1; i + 1 < n; ++i) {
+		qint32 piece = std::min(count - 1, qint32(qint64(prefix[i]) * count / std::max(prefix[n - 1], 1)));
+		pieces[piece].push_back(nodes[order[i]]);
+	}
+
+	// Step 2: route the pieces one after another; each droplet avoids the ones planned before
+	QVector<QVector<qint32>> planned;
+	QVector<Position> entries, exits;
+	reserved.clear();
+	protocol = OccupancyIndex();
+	qint32 finish = 0;
+	for (qint32 i = 0; i < count; ++i) {
+		if (pieces[i].empty()) continue;
+		qint32 entry = nearest(sources, distanceField(pieces[i].front()));
+		qint32 exit = nearest(sinks, distanceField(pieces[i].back()));
+
+		QVector<qint32> route;
+		if (!routeInTime(entry, pieces[i], exit, 0, 0, route)) {
+			// Wait outside the chip until all other droplets are gone
+			if (!routeInTime(entry, pieces[i], exit, finish, 0, route)) {
+				return NoRoute;
+			}
+		}
+		for (qint32 t = 0; t < route.size(); ++t) {
+			reserve(t, route[t]);
+		}
+		finish = std::max(finish, route.size());
+		planned.push_back(route);
+		entries.push_back(outside(entry, rows, config));
+		exits.push_back(outside(exit, rows, config));
+	}
+
+	// Step 3: convert to positions, outside the chip before entering and after leaving
+	qint32 makespan = 0;
+	for (qint32 i = 0; i < planned.size(); ++i) {
+		makespan = std::max(makespan, planned[i].size());
+	}
+	for (qint32 i = 0; i < planned.size(); ++i) {
+		QVector<Position> route;
+		for (qint32 t = 0; t <= makespan; ++t) {
+			qint32 cell = t < planned[i].size() ? planned[i][t] : -2;
+			if (cell >= 0) {
+				route.push_back(Position(cell / rows, cell % rows));
+			} else {
+				route.push_back(cell == -1 ? entries[i] : exits[i]);
+			}
+		}
+		routes.push_back(route);
+	}
+
+	length = makespan;
+	if (iter != cache.end()) {
+		iter->fleets[count] = routes;
+	}
+	return Planned;
+}
+
+WashPlanner::Result WashPlanner::planOnline(const ChipConfig &config, const CellMask &obstacles, const OccupancyIndex &occupancy, const QVector<WashDemand> &demands, qint32 start, QVector<WashTrip> &trips, qint32 &missed) {
+	trips.clear();
+	missed = 0;
+	if (demands.empty()) {
+		return NothingToWash;
+	}
+	if (!prepare(config, obstacles)) {
+		return NoRoute;
+	}
+	QVector<qint32> fromSources;
+	bfs(sources, fromSources);
+	if (nearest(sinks, fromSources) < 0) {
+		return NoRoute;
+	}
+
+	// Step 1: the droplets of the protocol come first
+	reserved.clear();
+	protocol = occupancy;
+
+	// Step 2: serve the demands by deadline; a trip also serves the later demands on its way
+	QVector<WashDemand> queue = demands;
+	std::stable_sort(queue.begin(), queue.end(), [](const WashDemand &a, const WashDemand &b) -> bool { return a.deadline < b.deadline; });
+	QVector<bool> served(queue.size(), false);
+	for (qint32 i = 0; i < queue.size(); ++i) {
+		if (served[i]) continue;
+		const WashDemand &d = queue[i];
+		qint32 cell = d.x * rows + d.y;
+		if (blocked.test(d.x, d.y) || fromSources[cell] < 0) {
+			++missed;
+			continue;
+		}
+		QVector<qint32> around = distanceField(cell);
+		qint32 exit = nearest(sinks, around);
+		if (exit < 0) {
+			++missed;
+			continue;
+		}
+
+		// Try the wash ports from the nearest one on, in case it is crowded at the time
+		QVector<qint32> entries;
+		for (qint32 j = 0; j < sources.size(); ++j) {
+			if (around[sources[j]] >= 0) {
+				entries.push_back(sources[j]);
+			}
+		}
+		std::stable_sort(entries.begin(), entries.end(), [&](qint32 a, qint32 b) -> bool { return around[a] < around[b]; });
+
+		QVector<qint32> route;
+		qint32 entry = -1, earliest = start;
+		for (qint32 j = 0; j < entries.size() && entry < 0; ++j) {
+			// Enter the chip no earlier than needed to reach the cell right after the residue is left
+			earliest = std::max(start, d.release - around[entries[j]]);
+			if (!routeInTime(entries[j], QVector<qint32>({cell}), exit, earliest, d.release + 1, route)) continue;
+			qint32 arrival = d.release + 1;
+			while (route[arrival] != cell) {
+				++arrival;
+			}
+			if (arrival < d.deadline) {
+				entry = entries[j];
+			}
+		}
+		if (entry < 0) {
+			++missed;
+			continue;
+		}
+
+		WashTrip trip;
+		trip.start = earliest;
+		while (route[trip.start + 1] < 0) {
+			++trip.start; // wait at the wash port
+		}
+		for (qint32 t = trip.start; t < route.size(); ++t) {
+			reserve(t, route[t]);
+			if (route[t] >= 0) {
+				trip.steps.push_back(Position(route[t] / rows, route[t] % rows));
+			} else {
+				trip.steps.push_back(outside(route[t] == -1 ? entry : exit, rows, config));
+			}
+		}
+		trips.push_back(trip);
+
+		for (qint32 j = i; j < queue.size(); ++j) {
+			qint32 at = queue[j].x * rows + queue[j].y;
+			for (qint32 t = queue[j].release + 1; t < queue[j].deadline && t < route.size() && !served[j]; ++t) {
+				served[j] = route[t] == at;
+			}
+		}
+	}
+
+	return trips.empty() ? NoRoute : Planned;
+}
+
+qint32 WashPlanner::routeLength() const {
+	return length;
+}
+
+bool WashPlanner::prepare(const ChipConfig &config, const CellMask &obstacles) {
+	rows = config.rows;
+	columns = config.columns;
+
+	blocked = obstacles;
+
+	// Distance fields only depend on the obstacles, keep them while the obstacles stay the same
+	if (blocked != fieldBlocked) {
+		fields.clear();
+		fieldBlocked = blocked;
+	}
+
+	// Ports covered by obstacles are skipped, the others can still be used
+	sources.clear();
+	sinks.clear();
+	for (qint32 x = 0; x < columns; ++x) {
+		for (qint32 y = 0; y < rows; ++y) {
+			if (blocked.test(x, y)) continue;
+			if (isPortType(x, y, config, PortType::wash)) {
+				sources.push_back(x * rows + y);
+			}
+			if (isPortType(x, y, config, PortType::waste)) {
+				sinks.push_back(x * rows + y);
+			}
+		}
+	}
+	return !sources.empty() && !sinks.empty();
+}
+
+void WashPlanner::bfs(const QVector<qint32> &seeds, QVector<qint32> &dist) const {
+	dist.fill(-1, rows * columns);
+	QVector<qint32> queue;
+	queue.reserve(rows * columns);
+	for (qint32 i = 0; i < seeds.size(); ++i) {
+		queue.push_back(seeds[i]);
+		dist[seeds[i]] = 0;
+	}
+	for (qint32 head = 0; head < queue.size(); ++head) {
+		qint32 x = queue[head] / rows, y = queue[head] % rows;
+		for (qint32 k = 0; k < 4; ++k) {
+			qint32 nx = x + dirX[k], ny = y + dirY[k];
+			if (nx < 0 || nx >= columns || ny < 0 || ny >= rows) {
+				continue;
+			}
+			qint32 next = nx * rows + ny;
+			if (blocked.test(nx, ny) || dist[next] >= 0) {
+				continue;
+			}
+			dist[next] = dist[queue[head]] + 1;
+			queue.push_back(next);
+		}
+	}
+}
+
+const QVector<qint32> &WashPlanner::distanceField(qint32 cell) {
+	auto iter = fields.find(cell);
+	if (iter == fields.end()) {
+		iter = fields.insert(cell, QVector<qint32>());
+		bfs(QVector<qint32>({cell}), *iter);
+	}
+	return *iter;
+}
+
+qint32 WashPlanner::nearest(const QVector<qint32> &cells, const QVector<qint32> &dist) const {
+	qint32 best = -1;
+	for (qint32 i = 0; i < cells.size(); ++i) {
+		if (dist[cells[i]] >= 0 && (best < 0 || dist[cells[i]] < dist[best])) {
+			best = cells[i];
+		}
+	}
+	return best;
+}
+
+QVector<qint32> WashPlanner::orderedCells() const {
+	QVector<qint32> cells;
+	for (qint32 i = 0; i < order.size(); ++i) {
+		cells.push_back(nodes[order[i]]);
+	}
+	return cells;
+}
+
+bool WashPlanner::repairTour(QVector<qint32> &tour) const {
+	// Keep the previous visiting order of the remaining targets and insert the new ones where they cost the least
+	qint32 n = nodes.size();
+	if (lastTour.size() < 2) return false;
+
+	QHash<qint32, qint32> index; // cell -> node
+	for (qint32 i = 1; i + 1 < n; ++i) {
+		index[nodes[i]] = i;
+	}
+	QVector<bool> placed(n, false);
+	tour.clear();
+	tour.push_back(0);
+	for (qint32 i = 1; i + 1 < lastTour.size(); ++i) {
+		auto iter = index.constFind(lastTour[i]);
+		if (iter != index.constEnd() && !placed[*iter]) {
+			placed[*iter] = true;
+			tour.push_back(*iter);
+		}
+	}
+	tour.push_back(n - 1);
+
+	qint32 added = 0;
+	for (qint32 i = 1; i + 1 < n; ++i) {
+		added += placed[i] ? 0 : 1;
+	}
+	if (added * 2 > n) return false; // too different, build a new tour
+
+	for (qint32 v = 1; v + 1 < n; ++v) {
+		if (placed[v]) continue;
+		qint32 best = 1, bestCost = -1;
+		for (qint32 j = 1; j < tour.size(); ++j) {
+			qint32 a = tour[j - 1], b = tour[j];
+			qint32 cost = matrix[a * n + v] + matrix[v * n + b] - matrix[a * n + b];
+			if (bestCost < 0 || cost < bestCost) {
+				best = j;
+				bestCost = cost;
+			}
+		}
+		tour.insert(best, v);
+	}
+	return true;
+}
+
+void WashPlanner::nearestNeighbour(QVector<qint32> &tour) const {
+	qint32 n = nodes.size();
+	QVector<bool> visited(n, false);
+	tour.clear();
+	tour.push_back(0);
+	visited[0] = visited[n - 1] = true;
+	for (qint32 i = 1; i + 1 < n; ++i) {
+		qint32 cur = tour.back(), best = -1;
+		for (qint32 j = 1; j + 1 < n; ++j) {
+			if (!visited[j] && (best < 0 || matrix[cur * n + j] < matrix[cur * n + best])) {
+				best = j;
+			}
+		}
+		visited[best] = true;
+		tour.push_back(best);
+	}
+	tour.push_back(n - 1);
+}
+
+bool WashPlanner::twoOpt(QVector<qint32> &tour) const {
+	// Reverse tour[i..j]; both ends of the tour are fixed
+	qint32 n = nodes.size(), m = tour.size();
+	bool improved = false;
+	for (qint32 i = 1; i + 1 < m; ++i) {
+		for (qint32 j = i + 1; j + 1 < m; ++j) {
+			qint32 a = tour[i - 1], b = tour[i], c = tour[j], d = tour[j + 1];
+			qint32 delta = matrix[a * n + c] + matrix[b * n + d] - matrix[a * n + b] - matrix[c * n + d];
+			if (delta < 0) {
+				std::reverse(tour.begin() + i, tour.begin() + j + 1);
+				improved = true;
+			}
+		}
+	}
+	return improved;
+}
+
+bool WashPlanner::orOpt(QVector<qint32> &tour) const {
+	// Move a segment of up to orOptSegment nodes (possibly reversed) to another position
+	qint32 n = nodes.size(), m = tour.size();
+	for (qint32 len = 1; len <= orOptSegment; ++len) {
+		for (qint32 i = 1; i + len < m; ++i) {
+			qint32 a = tour[i - 1], s0 = tour[i], s1 = tour[i + len - 1], b = tour[i + len];
+			qint32 gain = matrix[a * n + s0] + matrix[s1 * n + b] - matrix[a * n + b];
+			for (qint32 j = 0; j + 1 < m; ++j) {
+				if (j >= i - 1 && j < i + len) continue; // edge adjacent to or inside the segment
+				qint32 p = tour[j], q = tour[j + 1];
+				qint32 cost = matrix[p * n + s0] + matrix[s1 * n + q] - matrix[p * n + q];
+				qint32 costReversed = matrix[p * n + s1] + matrix[s0 * n + q] - matrix[p * n + q];
+				if (std::min(cost, costReversed) >= gain) continue;
+
+				QVector<qint32> segment = tour.mid(i, len);
+				if (costReversed < cost) {
+					std::reverse(segment.begin(), segment.end());
+				}
+				tour.remove(i, len);
+				qint32 pos = (j < i ? j + 1 : j + 1 - len);
+				for (qint32 k = 0; k < len; ++k) {
+					tour.insert(pos + k, segment[k]);
+				}
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+void WashPlanner::appendPath(qint32 from, qint32 to, QVector<Position> &steps) const {
+	// Walk down the distance field of the destination
+	const QVector<qint32> &dist = field[to];
+	qint32 cur = nodes[from];
+	while (dist[cur] > 0) {
+		qint32 x = cur / rows, y = cur % rows;
+		for (qint32 k = 0; k < 4; ++k) {
+			qint32 nx = x + dirX[k], ny = y + dirY[k];
+			if (nx < 0 || nx >= columns || ny < 0 || ny >= rows) {
+				continue;
+			}
+			if (dist[nx * rows + ny] == dist[cur] - 1) {
+				cur = nx * rows + ny;
+				break;
+			}
+		}
+		steps.push_back(Position(cur / rows, cur % rows));
+	}
+}
+
+bool WashPlanner::routeInTime(qint32 entry, const QVector<qint32> &targets, qint32 exit, qint32 earliest, qint32 notBefore, QVector<qint32> &route) const {
+	// Cell index -1 stands for outside the chip at the wash port before entering, -2 for having left through the waste port.
+	// The first target only counts when reached at second notBefore or later.
+	QVector<qint32> waypoints = targets;
+	waypoints.push_back(exit);
+	waypoints.push_back(-2);
+	qint32 cells = rows * columns;
+	qint32 horizon = std::max(cells * 2, std::max(reserved.size(), protocol.horizon()) - earliest + cells);
+
+	route.fill(-1, earliest + 1);
+	qint32 cur = -1, t = earliest;
+	for (qint32 w = 0; w < waypoints.size(); ++w) {
+		qint32 goal = waypoints[w];
+		if (cur == goal) continue;
+
+		// Breadth-first search layer by layer in time
+		QHash<qint64, qint32> parent; // (t, cell) -> cell at t - 1
+		QVector<qint32> frontier;
+		frontier.push_back(cur);
+		qint32 found = -1;
+		for (qint32 step = 0; step < horizon && !frontier.empty() && found < 0; ++step) {
+			QVector<qint32> next;
+			qint32 now = t + step + 1;
+			for (qint32 i = 0; i < frontier.size() && found < 0; ++i) {
+				qint32 from = frontier[i];
+				QVector<qint32> moves;
+				moves.push_back(from);
+				if (from < 0) {
+					moves.push_back(entry);
+				} else {
+					if (from == exit && goal == -2) {
+						moves.push_back(-2);
+					}
+					qint32 x = from / rows, y = from % rows;
+					for (qint32 k = 0; k < 4; ++k) {
+						qint32 nx = x + dirX[k], ny = y + dirY[k];
+						if (nx >= 0 && nx < columns && ny >= 0 && ny < rows && !blocked.test(nx, ny)) {
+							moves.push_back(nx * rows + ny);
+						}
+					}
+				}
+				for (qint32 k = 0; k < moves.size(); ++k) {
+					qint32 to = moves[k];
+					qint64 key = qint64(now) * (cells + 2) + (to + 2);
+					if (parent.contains(key) || conflicts(now, from, to)) {
+						continue;
+					}
+					parent[key] = from;
+					next.push_back(to);
+					if (to == goal && (w > 0 || now >= notBefore)) {
+						found = now;
+						break;
+					}
+				}
+			}
+			frontier = next;
+		}
+		if (found < 0) {
+			return false;
+		}
+
+		// Trace back the path of this leg
+		QVector<qint32> leg;
+		for (qint32 c = goal, s = found; s > t; --s) {
+			leg.push_back(c);
+			c = parent[qint64(s) * (cells + 2) + (c + 2)];
+		}
+		for (qint32 i = leg.size() - 1; i >= 0; --i) {
+			route.push_back(leg[i]);
+		}
+		cur = goal;
+		t = found;
+	}
+	return true;
+}
+
+void WashPlanner::reserve(qint32 t, qint32 cell) {
+	if (t < 0 || cell < 0) return; // outside the chip
+	if (t >= reserved.size()) {
+		reserved.resize(t + 1);
+	}
+	if (reserved[t].isNull()) {
+		reserved[t] = CellMask(rows, columns);
+	}
+	qint32 x = cell / rows, y = cell % rows;
+	reserved[t].setRect(x - 1, y - 1, x + 1, y + 1);
+}
+
+bool WashPlanner::busy(qint32 t, qint32 cell) const {
+	if (t < 0 || cell < 0) return false;
+	if (protocol.near(cell / rows, cell % rows, t)) return true;
+	return t < reserved.size() && !reserved[t].isNull() && reserved[t].test(cell / rows, cell % rows);
+}
+
+bool WashPlanner::conflicts(qint32 t, qint32 from, qint32 to) const {
+	// Moving from (from, t - 1) to (to, t) must keep the distance constraints against every reserved droplet
+	return busy(t, to) || busy(t - 1, to) || busy(t, from);
+}
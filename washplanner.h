@@ -0,0 +1,89 @@
+#ifndef WASHPLANNER_H
+#define WASHPLANNER_H
+
+#include <QHash>
+#include <QVector>
+#include <QByteArray>
+
+#include "utility.h"
+
+// A wash droplet trip during the run of a protocol: steps[i] is its position at second start + i,
+// from outside the chip at the wash port to outside the chip at the waste port.
+struct WashTrip {
+	qint32 start;
+	QVector<Position> steps;
+};
+
+// Plans the route of the wash droplet: from a wash port through all target cells to a waste port.
+// Obstacle-aware distances between all targets are computed once by BFS, then the visiting order is
+// solved as a path TSP with nearest-neighbour construction followed by 2-opt and Or-opt improvement.
+// Plans are cached by obstacles and targets; distance fields are kept while the obstacles stay the same,
+// and a changed set of targets is planned by repairing the previous tour. With several ports, the droplet
+// enters through the wash port nearest to its first target and leaves through the waste port nearest to its last.
+class WashPlanner {
+public:
+	enum Result {
+		Planned, NoRoute, NothingToWash
+	};
+
+	explicit WashPlanner(qint32 budget = 200);
+
+	// Set cells of obstacles are electrodes the wash droplet must avoid.
+	// On success steps holds one position per second, starting and ending outside the chip at the ports.
+	Result plan(const ChipConfig &config, const CellMask &obstacles, const QVector<Position> &targets, QVector<Position> &steps);
+
+	// Wash with several droplets at once. The tour of plan() is cut into count pieces of similar length, and the
+	// droplets are routed one after another in the time-expanded grid so that they keep the same distance
+	// constraints as droplets of the protocol. All routes have the same length, one position per second.
+	Result planFleet(const ChipConfig &config, const CellMask &obstacles, const QVector<Position> &targets, qint32 count, QVector<QVector<Position>> &routes);
+
+	// Wash while the protocol runs. Every demand gets a trip from the wash port through its cell to the waste port,
+	// reaching the cell after the residue is left and before the next droplet arrives. Trips are routed in
+	// the time-expanded grid around the droplets of the protocol and the trips planned before; demands
+	// which cannot be met in time are counted in missed.
+	Result planOnline(const ChipConfig &config, const CellMask &obstacles, const OccupancyIndex &occupancy, const QVector<WashDemand> &demands, qint32 start, QVector<WashTrip> &trips, qint32 &missed);
+
+	qint32 routeLength() const;
+
+private:
+	bool prepare(const ChipConfig &config, const CellMask &obstacles);
+	void bfs(const QVector<qint32> &seeds, QVector<qint32> &dist) const;
+	qint32 nearest(const QVector<qint32> &cells, const QVector<qint32> &dist) const;
+	const QVector<qint32> &distanceField(qint32 cell);
+	QVector<qint32> orderedCells() const;
+	bool repairTour(QVector<qint32> &tour) const;
+	void nearestNeighbour(QVector<qint32> &tour) const;
+	bool twoOpt(QVector<qint32> &tour) const;
+	bool orOpt(QVector<qint32> &tour) const;
+	void appendPath(qint32 from, qint32 to, QVector<Position> &steps) const;
+	bool routeInTime(qint32 entry, const QVector<qint32> &targets, qint32 exit, qint32 earliest, qint32 notBefore, QVector<qint32> &route) const;
+	void reserve(qint32 t, qint32 cell);
+	bool busy(qint32 t, qint32 cell) const;
+	bool conflicts(qint32 t, qint32 from, qint32 to) const;
+
+	qint32 budget; // time limit of the tour improvement, in milliseconds
+
+	qint32 rows, columns;
+	CellMask blocked;
+	QVector<qint32> sources, sinks; // cells of the usable wash and waste ports
+	QVector<qint32> nodes; // cells of the tour nodes: wash port, targets, waste port
+	QVector<QVector<qint32>> field; // BFS distance field of every node
+	QVector<qint32> matrix; // distances between nodes, indexed by i * nodes.size() + j
+	QVector<qint32> order; // visiting order of the nodes
+	qint32 length;
+	QVector<CellMask> reserved; // reserved[t]: cells within distance 1 of some wash droplet at second t
+	OccupancyIndex protocol; // droplets of the protocol during the online wash
+
+	struct CachedPlan {
+		QVector<qint32> nodes, order, matrix;
+		QVector<Position> steps;
+		QHash<qint32, QVector<QVector<Position>>> fleets; // routes by number of wash droplets
+	};
+	QHash<QByteArray, CachedPlan> cache;
+	QByteArray key; // cache key of the last plan
+	CellMask fieldBlocked; // obstacles the distance fields were computed with
+	QHash<qint32, QVector<qint32>> fields; // distance field by source cell
+	QVector<qint32> lastTour; // cells of the last tour, in visiting order
+};
+
+#endif // WASHPLANNER_H